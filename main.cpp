@@ -2,12 +2,52 @@
 #include <string>
 #include <vector>
 #include <stack>
+#include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <string_view>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <new>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 #include <iostream>
 
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 enum class TokenType {
     Number,
     Operator,
-    Symbol
+    Symbol,
+    Variable
 };
 
 class Token {
@@ -31,6 +71,9 @@ public:
         case TokenType::Symbol:
             prefix += "Symbol";
             break;
+        case TokenType::Variable:
+            prefix += "Variable";
+            break;
         default:
             prefix += "Unknown";
             break;
@@ -52,6 +95,11 @@ public:
     int64_t getIntValue() {
         return std::atoll(d_value.c_str());
     }
+
+    // Literals with a decimal point only evaluate in decimal mode
+    bool isFractional() const {
+        return d_value.find('.') != std::string::npos;
+    }
 };
 
 class OperatorToken : public Token {
@@ -79,6 +127,243 @@ public:
     virtual TokenType type() const override { return TokenType::Symbol; }
 };
 
+/*
+    Symbol table
+
+    Interns variable names into dense IDs once, at lex time, so compilation and
+    binding work on integers instead of hashing and comparing strings for every
+    occurrence of a variable. Interning is thread-safe; names are never removed.
+
+    A known variable schema can be installed up front: its names get the first
+    IDs in schema order and are resolved through a collision-free (perfect) hash
+    built by hash-and-displace, without taking the lock. The schema is built
+    aside and published once through an atomic pointer, so lexing may run
+    concurrently with its installation.
+
+    Names come from untrusted input, so the table holds at most
+    SYMBOL_TABLE_CAPACITY of them. Once it is full, a new name gets no ID and
+    its variable tokens carry the name themselves: such input is lexed and
+    compiled by name, more slowly, instead of failing, and binding by symbol
+    ID leaves those variables unbound.
+*/
+
+// Seeded FNV-1a with a final mix so the high bits reach the low ones
+inline uint64_t hashString(std::string_view text, uint64_t seed = 0) {
+    uint64_t hash = 0xCBF29CE484222325ull ^ (seed * 0x9E3779B97F4A7C15ull);
+    for (char c : text)
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+
+    return hash ^ (hash >> 29);
+}
+
+constexpr size_t SYMBOL_TABLE_CAPACITY = 1 << 20;
+
+class SymbolTable {
+public:
+    static constexpr uint32_t NO_SYMBOL = std::numeric_limits<uint32_t>::max();
+
+    // Returns NO_SYMBOL for a new name once the table is full
+    uint32_t intern(std::string_view name) {
+        uint32_t symbol = findInSchema(name);
+        if (symbol != NO_SYMBOL)
+            return symbol;
+
+        {
+            std::shared_lock<std::shared_mutex> lock(d_mutex);
+            symbol = findLocked(name);
+            if (symbol != NO_SYMBOL)
+                return symbol;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(d_mutex);
+        symbol = findLocked(name);
+        if (symbol != NO_SYMBOL || d_names.size() >= SYMBOL_TABLE_CAPACITY)
+            return symbol;
+
+        symbol = static_cast<uint32_t>(d_names.size());
+        d_names.emplace_back(name);
+
+        if ((d_names.size() * 2) > d_slots.size())
+            rehash(std::max<size_t>(64, d_slots.size() * 2));
+        else
+            insertSlot(symbol);
+
+        return symbol;
+    }
+
+    // Returns NO_SYMBOL for a name that was never interned
+    uint32_t find(std::string_view name) const {
+        uint32_t symbol = findInSchema(name);
+        if (symbol != NO_SYMBOL)
+            return symbol;
+
+        std::shared_lock<std::shared_mutex> lock(d_mutex);
+        return findLocked(name);
+    }
+
+    // Names are never removed and d_names is a deque, so the reference stays valid
+    const std::string& name(uint32_t symbol) const {
+        std::shared_lock<std::shared_mutex> lock(d_mutex);
+        return d_names[symbol];
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(d_mutex);
+        return d_names.size();
+    }
+
+    // Interns the schema names first and builds a perfect hash over them, returns false if
+    // other names or a schema were installed already or the schema exceeds the capacity.
+    bool setSchema(const std::vector<std::string>& names) {
+        std::unique_lock<std::shared_mutex> lock(d_mutex);
+        if (!d_names.empty() || d_schema.load(std::memory_order_relaxed) || names.size() > SYMBOL_TABLE_CAPACITY)
+            return false;
+
+        for (auto& name : names) {
+            if (findLocked(name) != NO_SYMBOL)
+                continue;
+
+            d_names.push_back(name);
+            if ((d_names.size() * 2) > d_slots.size())
+                rehash(std::max<size_t>(64, d_slots.size() * 2));
+            else
+                insertSlot(static_cast<uint32_t>(d_names.size() - 1));
+        }
+
+        // Hash and displace: names are grouped into buckets and each bucket, largest
+        // first, searches for a seed that puts all of its names into free slots.
+        size_t bucketCount = std::max<size_t>(1, d_names.size() / 2);
+        size_t size = 1;
+        while (size < d_names.size() * 2)
+            size *= 2;
+
+        std::vector<std::vector<uint32_t>> buckets(bucketCount);
+        for (uint32_t symbol = 0; symbol < d_names.size(); ++symbol)
+            buckets[hashName(d_names[symbol], 0) % bucketCount].push_back(symbol);
+
+        std::vector<size_t> order(bucketCount);
+        for (size_t bucket = 0; bucket < bucketCount; ++bucket)
+            order[bucket] = bucket;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+        std::vector<uint32_t> slots(size, NO_SYMBOL);
+        std::vector<uint64_t> seeds(bucketCount, 0);
+        std::vector<size_t> placed;
+
+        for (size_t bucket : order) {
+            for (uint64_t seed = 1;; ++seed) {
+                placed.clear();
+                for (uint32_t symbol : buckets[bucket]) {
+                    size_t slot = hashName(d_names[symbol], seed) & (size - 1);
+                    if (slots[slot] != NO_SYMBOL)
+                        break;
+
+                    slots[slot] = symbol;
+                    placed.push_back(slot);
+                }
+
+                if (placed.size() == buckets[bucket].size()) {
+                    seeds[bucket] = seed;
+                    break;
+                }
+
+                for (size_t slot : placed)
+                    slots[slot] = NO_SYMBOL;
+            }
+        }
+
+        auto schema = std::make_unique<Schema>();
+        schema->d_names.assign(d_names.begin(), d_names.end());
+        schema->d_slots = std::move(slots);
+        schema->d_seeds = std::move(seeds);
+
+        d_schema.store(schema.get(), std::memory_order_release);
+        d_schemaStorage = std::move(schema);
+        return true;
+    }
+
+private:
+    static uint64_t hashName(std::string_view name, uint64_t seed) { return hashString(name, seed); }
+
+    // Immutable once published
+    struct Schema {
+        std::vector<std::string>    d_names;
+        std::vector<uint32_t>       d_slots;
+        std::vector<uint64_t>       d_seeds;    // Displacement seed per bucket
+    };
+
+    uint32_t findInSchema(std::string_view name) const {
+        const Schema* schema = d_schema.load(std::memory_order_acquire);
+        if (!schema)
+            return NO_SYMBOL;
+
+        uint64_t seed = schema->d_seeds[hashName(name, 0) % schema->d_seeds.size()];
+        uint32_t symbol = schema->d_slots[hashName(name, seed) & (schema->d_slots.size() - 1)];
+        if (symbol != NO_SYMBOL && schema->d_names[symbol] == name)
+            return symbol;
+
+        return NO_SYMBOL;
+    }
+
+    uint32_t findLocked(std::string_view name) const {
+        if (d_slots.empty())
+            return NO_SYMBOL;
+
+        size_t mask = d_slots.size() - 1;
+        for (size_t slot = hashName(name, 0) & mask;; slot = (slot + 1) & mask) {
+            uint32_t symbol = d_slots[slot];
+            if (symbol == NO_SYMBOL || d_names[symbol] == name)
+                return symbol;
+        }
+    }
+
+    void insertSlot(uint32_t symbol) {
+        size_t mask = d_slots.size() - 1;
+        size_t slot = hashName(d_names[symbol], 0) & mask;
+        while (d_slots[slot] != NO_SYMBOL)
+            slot = (slot + 1) & mask;
+
+        d_slots[slot] = symbol;
+    }
+
+    void rehash(size_t size) {
+        d_slots.assign(size, NO_SYMBOL);
+        for (uint32_t symbol = 0; symbol < d_names.size(); ++symbol)
+            insertSlot(symbol);
+    }
+
+    mutable std::shared_mutex   d_mutex;
+    std::deque<std::string>     d_names;        // Symbol -> name
+    std::vector<uint32_t>       d_slots;        // Open addressing over d_names
+
+    std::atomic<const Schema*>      d_schema = nullptr;     // Installed at most once
+    std::unique_ptr<const Schema>   d_schemaStorage;
+};
+
+SymbolTable& symbolTable() {
+    static SymbolTable table;
+    return table;
+}
+
+// Holds only the symbol ID and looks the name up where it is needed, unless the symbol
+// table was full and the token keeps its own name
+class VariableToken : public Token {
+public:
+    VariableToken(uint32_t symbol) : Token(std::string()), d_symbol(symbol) {}
+    VariableToken(std::string_view name) : Token(std::string(name)), d_symbol(SymbolTable::NO_SYMBOL) {}
+
+    const std::string& name() const { return d_symbol == SymbolTable::NO_SYMBOL ? d_value : symbolTable().name(d_symbol); }
+
+    uint32_t d_symbol;
+
+    // Inherited via Token
+    virtual TokenType type() const override { return TokenType::Variable; }
+
+    virtual std::string toString() const override {
+        return "('Variable': '" + name() + "')";
+    }
+};
+
 using TokenRef = std::shared_ptr<Token>;
 
 template <typename T, typename... Args>
@@ -87,12 +372,199 @@ constexpr std::shared_ptr<Token> makeToken(Args&& ... args)
     return std::make_shared<T>(std::forward<Args>(args)...);
 }
 
+TokenRef makeVariableToken(std::string_view name) {
+    uint32_t symbol = symbolTable().intern(name);
+    return symbol == SymbolTable::NO_SYMBOL ? makeToken<VariableToken>(name) : makeToken<VariableToken>(symbol);
+}
+
 template <typename T, typename... Args>
 constexpr std::shared_ptr<T> as(Args&&... args)
 {
     return std::static_pointer_cast<T>(std::forward<Args>(args)...);
 }
 
+enum class OpCode : uint8_t {
+    PushConstant,
+    PushVariable,
+    PushLiteral,    // Lifted literal, d_operand indexes the expression's literal array
+
+    // Unary operators
+    Negate,
+    LogicalNot,
+
+    // Binary operators
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual,
+    Power,
+
+    // Specialized forms emitted by the compiler
+    PowerConstant,  // Unary, raises the top of the stack to the exponent in d_operand
+
+    // Bitwise operators
+    BitwiseNot,
+    BitwiseAnd,
+    BitwiseOr,
+    BitwiseXor,
+    ShiftLeft,
+    ShiftRight,
+    Modulo,
+
+    // Fixed-point decimal forms emitted by the decimal compiler, d_operand holds the encoded DecimalFormat
+    DecimalScale,       // Unary, scales a 0 or 1 truth value to the decimal one
+    DecimalMultiply,
+    DecimalDivide
+};
+
+struct OperatorInfo {
+    const char* d_symbol;
+    OpCode      d_opcode;
+    uint32_t    d_precedence;
+    bool        d_leftAssociative;
+    bool        d_unary;
+};
+
+// Prefix operators bind tighter than any binary operator but power, so -2 ** 2 is -(2 ** 2)
+constexpr uint32_t UNARY_OPERATOR_PRECEDENCE = 9;
+constexpr uint32_t POWER_OPERATOR_PRECEDENCE = 10;
+
+// Operator set understood by the parser and the evaluators,
+// higher precedence binds tighter (C-like ordering). Binary
+// token corpora store indices into this table, so new
+// operators are appended.
+static const OperatorInfo OPERATOR_TABLE[] = {
+    { "==", OpCode::Equal,          4, true,  false },
+    { "!=", OpCode::NotEqual,       4, true,  false },
+    { "<",  OpCode::Less,           5, true,  false },
+    { "<=", OpCode::LessEqual,      5, true,  false },
+    { ">",  OpCode::Greater,        5, true,  false },
+    { ">=", OpCode::GreaterEqual,   5, true,  false },
+    { "+",  OpCode::Add,            7, true,  false },
+    { "-",  OpCode::Subtract,       7, true,  false },
+    { "*",  OpCode::Multiply,       8, true,  false },
+    { "/",  OpCode::Divide,         8, true,  false },
+    { "!",  OpCode::LogicalNot,     UNARY_OPERATOR_PRECEDENCE, false, true },
+    { "**", OpCode::Power,          POWER_OPERATOR_PRECEDENCE, false, false },
+    { "^",  OpCode::BitwiseXor,     2, true,  false },
+    { "|",  OpCode::BitwiseOr,      1, true,  false },
+    { "&",  OpCode::BitwiseAnd,     3, true,  false },
+    { "<<", OpCode::ShiftLeft,      6, true,  false },
+    { ">>", OpCode::ShiftRight,     6, true,  false },
+    { "%",  OpCode::Modulo,         8, true,  false },
+    { "~",  OpCode::BitwiseNot,     UNARY_OPERATOR_PRECEDENCE, false, true },
+};
+
+const OperatorInfo* lookupOperator(std::string_view symbol) {
+    for (auto& info : OPERATOR_TABLE) {
+        if (symbol == info.d_symbol)
+            return &info;
+    }
+
+    return nullptr;
+}
+
+// Creates an operator token with the precedence and associativity from the operator table
+TokenRef makeOperatorToken(const std::string& symbol) {
+    auto info = lookupOperator(symbol);
+    if (!info) {
+        std::cout << "Unknown operator: " << symbol << "\n";
+        return makeToken<OperatorToken>(symbol);
+    }
+
+    return makeToken<OperatorToken>(symbol, info->d_precedence, info->d_leftAssociative, info->d_unary);
+}
+
+// Lexes tokens from the start of 'text' and returns how many characters were consumed, or
+// std::string::npos on an unexpected character. Unless 'endOfInput' is set, a token that
+// touches the end of 'text' is left unconsumed since the next chunk may continue it.
+// 'offset' is where 'text' starts in the whole input, so errors report input positions.
+size_t lexTokens(std::string_view text, std::vector<TokenRef>& tokens, bool endOfInput, size_t offset = 0) {
+    size_t i = 0;
+
+    while (i < text.size()) {
+        char c = text[i];
+        size_t start = i;
+
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            ++i;
+            continue;
+        }
+
+        if (c == '(' || c == ')') {
+            tokens.push_back(makeToken<SymbolToken>(std::string(1, c)));
+            ++i;
+            continue;
+        }
+
+        if (std::isdigit(static_cast<unsigned char>(c))) {
+            while (i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])))
+                ++i;
+
+            // A fractional part needs at least one digit after the point
+            if (i + 1 < text.size() && text[i] == '.' && std::isdigit(static_cast<unsigned char>(text[i + 1]))) {
+                i += 2;
+                while (i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])))
+                    ++i;
+            }
+
+            if ((i == text.size() || (i + 1 == text.size() && text[i] == '.')) && !endOfInput)
+                return start;
+
+            tokens.push_back(makeToken<NumberToken>(std::string(text.substr(start, i - start))));
+            continue;
+        }
+
+        if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+            while (i < text.size() && (std::isalnum(static_cast<unsigned char>(text[i])) || text[i] == '_'))
+                ++i;
+
+            if (i == text.size() && !endOfInput)
+                return start;
+
+            tokens.push_back(makeVariableToken(text.substr(start, i - start)));
+            continue;
+        }
+
+        // A one-character operator may be the first half of a two-character one
+        if (i + 1 == text.size() && !endOfInput)
+            return start;
+
+        if (i + 1 < text.size() && lookupOperator(text.substr(i, 2))) {
+            tokens.push_back(makeOperatorToken(std::string(text.substr(i, 2))));
+            i += 2;
+            continue;
+        }
+
+        if (lookupOperator(text.substr(i, 1))) {
+            tokens.push_back(makeOperatorToken(std::string(1, c)));
+            ++i;
+            continue;
+        }
+
+        std::cout << "Unexpected character '" << c << "' at position " << offset + i << "\n";
+        return std::string::npos;
+    }
+
+    return i;
+}
+
+// Splits an expression string into number, variable, operator and parenthesis tokens.
+// Operators are matched longest-first against the operator table.
+std::vector<TokenRef> tokenizeExpression(const std::string& expression) {
+    std::vector<TokenRef> tokens;
+    if (lexTokens(expression, tokens, true) == std::string::npos)
+        return {};
+
+    return tokens;
+}
+
 /*
     Test Expression: 4 + 2 * (3 - 1)
 
@@ -121,157 +593,6066 @@ constexpr std::shared_ptr<T> as(Args&&... args)
 
 // -6 + 2 * (-3 - 1) = -6 + (2 * -4) = -6 - 8 = -14 
 static std::vector<TokenRef> TOKENS = {
-    makeToken<OperatorToken>("-", 1, false),
+    makeOperatorToken("-"),
     makeToken<NumberToken>("6"),
-    makeToken<OperatorToken>("+", 1, true),
+    makeOperatorToken("+"),
     makeToken<NumberToken>("2"),
-    makeToken<OperatorToken>("*", 2, true),
+    makeOperatorToken("*"),
     makeToken<SymbolToken>("("),
-    makeToken<OperatorToken>("-", 1, false),
+    makeOperatorToken("-"),
     makeToken<NumberToken>("3"),
-    makeToken<OperatorToken>("-", 1, true),
+    makeOperatorToken("-"),
     makeToken<NumberToken>("1"),
     makeToken<SymbolToken>(")")
 };
 
-TokenRef readToken(std::vector<TokenRef>& tokens) {
-    auto token = tokens.at(0);
-    tokens.erase(tokens.begin());
-
-    return token;
-}
-
-std::stack<TokenRef> shuntingYardAlgorithm(std::vector<TokenRef>& inputQueue) {
-    std::stack<TokenRef> outputStack;
-    std::stack<TokenRef> operatorStack;
-
-    TokenRef previousToken = nullptr;
+// Incremental form of the shunting yard algorithm. Tokens are pushed one at a time and every
+// token leaving the algorithm is handed to 'emit' in postfix order, so the output can be
+// consumed as it is produced. Only the operator stack is retained between tokens.
+template <typename Emit>
+class ShuntingYard {
+public:
+    ShuntingYard(Emit emit) : d_emit(emit) {}
 
-    while (!inputQueue.empty()) {
-        // Read the next token from the input queue
-        auto token = readToken(inputQueue);
+    // Returns false when the token can't appear at this point of the expression
+    bool push(const TokenRef& token) {
+        // If the token is a number or a variable, we directly push it to the output stack
+        if (token->type() == TokenType::Number || token->type() == TokenType::Variable) {
+            if (!d_expectOperand)
+                return unexpectedToken(token);
 
-        // If the token is a number, we directly push ity to the output stack
-        if (token->type() == TokenType::Number)
-            outputStack.push(token);
+            d_emit(token);
+            d_expectOperand = false;
+        }
 
         // If the token is a left parenthesis, it goes directly to the operator stack
-        else if (token->d_value == "(")
-            operatorStack.push(token);
+        else if (token->d_value == "(") {
+            if (!d_expectOperand)
+                return unexpectedToken(token);
+
+            d_operatorStack.push_back(token);
+            d_maxDepth = std::max(d_maxDepth, d_operatorStack.size());
+        }
 
         // Check if the token is an operator
         else if (token->type() == TokenType::Operator) {
-            // Special check for a unary +/- operator
-            if (token->d_value == "+" || token->d_value == "-") {
-                if (!previousToken || (previousToken->type() == TokenType::Operator || previousToken->type() == TokenType::Symbol)) {
-                    as<OperatorToken>(token)->d_unary = true;
-                    as<OperatorToken>(token)->d_leftAssociative = false;
-                }
+            auto currentOperator = as<OperatorToken>(token);
+
+            // Special check for a unary +/- operator, where an operand is
+            // expected (at the start, after an operator or a left parenthesis)
+            // they are the prefix form.
+            if (d_expectOperand && (token->d_value == "+" || token->d_value == "-")) {
+                currentOperator->d_unary = true;
+                currentOperator->d_leftAssociative = false;
+                currentOperator->d_precedence = UNARY_OPERATOR_PRECEDENCE;
             }
 
-            while (!operatorStack.empty()) {
-                if (operatorStack.top()->d_value == "(")
+            // Prefix operators need an operand position, binary ones an operator position
+            if (currentOperator->d_unary != d_expectOperand)
+                return unexpectedToken(token);
+
+            // A prefix operator has no left operand, so it never completes the operators before it
+            while (!currentOperator->d_unary && !d_operatorStack.empty()) {
+                if (d_operatorStack.back()->d_value == "(")
                     break;
 
-                auto topOperator = as<OperatorToken>(operatorStack.top());
-                auto currentOperator = as<OperatorToken>(token);
+                auto topOperator = as<OperatorToken>(d_operatorStack.back());
 
                 if (topOperator->d_precedence < currentOperator->d_precedence)
                     break;
                 else if ((topOperator->d_precedence == currentOperator->d_precedence) && !currentOperator->d_leftAssociative)
                     break;
 
-                outputStack.push(operatorStack.top());
-                operatorStack.pop();
+                d_emit(d_operatorStack.back());
+                d_operatorStack.pop_back();
             }
 
             // Push the current operator to the operator stack
-            operatorStack.push(token);
+            d_operatorStack.push_back(token);
+            d_maxDepth = std::max(d_maxDepth, d_operatorStack.size());
+            d_expectOperand = true;
         }
 
         // Check if the token is a closing (right) parenthesis
         else if (token->d_value == ")") {
-            while (!operatorStack.empty()) {
-                if (operatorStack.top()->d_value == "(")
+            if (d_expectOperand)
+                return unexpectedToken(token);
+
+            while (!d_operatorStack.empty()) {
+                if (d_operatorStack.back()->d_value == "(")
                     break;
 
-                outputStack.push(operatorStack.top());
-                operatorStack.pop();
+                d_emit(d_operatorStack.back());
+                d_operatorStack.pop_back();
             }
 
-            if (operatorStack.empty() || operatorStack.top()->d_value != "(") {
+            if (d_operatorStack.empty() || d_operatorStack.back()->d_value != "(") {
                 std::cout << "Mismatched parenthesis error!\n";
-                break;
+                return false;
             }
 
             // Pop the left parenthesis off the operator stack
-            operatorStack.pop();
+            d_operatorStack.pop_back();
+        }
+
+        else
+            return unexpectedToken(token);
+
+        return true;
+    }
+
+    // Pops the remaining operators from the operator stack into the output,
+    // returns false if the expression is incomplete or has an unclosed parenthesis
+    bool finish() {
+        if (d_expectOperand) {
+            std::cout << "Unexpected end of expression!\n";
+            return false;
+        }
+
+        while (!d_operatorStack.empty()) {
+            if (d_operatorStack.back()->d_value == "(") {
+                std::cout << "Mismatched parenthesis error!\n";
+                return false;
+            }
+
+            d_emit(d_operatorStack.back());
+            d_operatorStack.pop_back();
         }
 
-        // Keep track of the previous token
-        previousToken = token;
+        return true;
+    }
+
+    // Deepest the operator stack has been, i.e. the nesting depth seen so far
+    size_t maxDepth() const { return d_maxDepth; }
+
+private:
+    bool unexpectedToken(const TokenRef& token) {
+        std::cout << "Unexpected token: " << token->toString() << "\n";
+        return false;
     }
 
-    // Pop the remaining operators from the operator stack into the output stack
-    while (!operatorStack.empty()) {
-        outputStack.push(operatorStack.top());
-        operatorStack.pop();
+    Emit                    d_emit;
+    std::vector<TokenRef>   d_operatorStack;
+    size_t                  d_maxDepth = 0;
+    bool                    d_expectOperand = true;
+};
+
+// Returns the expression in postfix order with the last token on top,
+// or an empty stack if the expression is malformed.
+std::stack<TokenRef> shuntingYardAlgorithm(std::vector<TokenRef>& inputQueue) {
+    std::stack<TokenRef> outputStack;
+    ShuntingYard parser([&outputStack](const TokenRef& token) { outputStack.push(token); });
+
+    // Read the tokens from the input queue in order, the consumed ones are removed
+    // in one go at the end rather than erasing from the front per token.
+    size_t consumed = 0;
+    bool wellFormed = true;
+    while (consumed < inputQueue.size() && wellFormed) {
+        auto token = inputQueue[consumed++];
+        wellFormed = parser.push(token);
     }
+    inputQueue.erase(inputQueue.begin(), inputQueue.begin() + consumed);
+
+    if (!wellFormed || !parser.finish())
+        return {};
 
     return outputStack;
 }
 
-int64_t evaluateExpressionTokens(std::stack<TokenRef>& expressionStack) {
-    auto token = expressionStack.top();
-    expressionStack.pop();
+/*
+    Precedence climbing
 
-    if (token->type() == TokenType::Number)
-        return as<NumberToken>(token)->getIntValue();
+    Alternative recursive parser driven by the same operator table. It produces
+    the same output stack as the shunting yard algorithm for well-formed input,
+    but recurses once per nesting level, so very deep expressions are bounded
+    by the native call stack.
+*/
 
-    if (token->type() == TokenType::Operator) {
-        if (as<OperatorToken>(token)->d_unary) {
-            int64_t rhs = evaluateExpressionTokens(expressionStack);
-            if (token->d_value == "!")
-                return static_cast<int64_t>(!static_cast<bool>(rhs));
-            else if (token->d_value == "+")
-                return rhs;
-            else if (token->d_value == "-")
-                return -rhs;
-        } else {
-            int64_t rhs = evaluateExpressionTokens(expressionStack);
-            int64_t lhs = evaluateExpressionTokens(expressionStack);
+class PrecedenceClimbingParser {
+public:
+    PrecedenceClimbingParser(const std::vector<TokenRef>& tokens, std::stack<TokenRef>& outputStack)
+        : d_tokens(tokens), d_outputStack(outputStack) {}
 
-            if (token->d_value == "+")
-                return lhs + rhs;
-            else if (token->d_value == "-")
-                return lhs - rhs;
-            else if (token->d_value == "*")
-                return lhs * rhs;
-            else if (token->d_value == "/")
-                return lhs / rhs;
+    // Returns false on a malformed expression
+    bool parse() {
+        if (!parseExpression(0))
+            return false;
+
+        if (d_position != d_tokens.size()) {
+            std::cout << "Unexpected token: " << d_tokens[d_position]->toString() << "\n";
+            return false;
         }
+
+        return true;
     }
 
-    std::cout << "Error evaluating token: " << token->toString() << "\n";
-    return 0;
+private:
+    bool parseExpression(uint32_t minPrecedence) {
+        if (!parsePrimary())
+            return false;
+
+        while (d_position < d_tokens.size() && d_tokens[d_position]->type() == TokenType::Operator) {
+            auto op = as<OperatorToken>(d_tokens[d_position]);
+            if (op->d_unary || op->d_precedence < minPrecedence)
+                break;
+
+            ++d_position;
+
+            // A left-associative operator only lets tighter operators into its right operand
+            if (!parseExpression(op->d_leftAssociative ? op->d_precedence + 1 : op->d_precedence))
+                return false;
+
+            d_outputStack.push(op);
+        }
+
+        return true;
+    }
+
+    bool parsePrimary() {
+        if (d_position >= d_tokens.size()) {
+            std::cout << "Unexpected end of expression!\n";
+            return false;
+        }
+
+        auto token = d_tokens[d_position++];
+
+        if (token->type() == TokenType::Number || token->type() == TokenType::Variable) {
+            d_outputStack.push(token);
+            return true;
+        }
+
+        if (token->d_value == "(") {
+            if (!parseExpression(0))
+                return false;
+
+            if (d_position >= d_tokens.size() || d_tokens[d_position]->d_value != ")") {
+                std::cout << "Mismatched parenthesis error!\n";
+                return false;
+            }
+
+            ++d_position;
+            return true;
+        }
+
+        if (token->type() == TokenType::Operator) {
+            auto op = as<OperatorToken>(token);
+
+            // In operand position +/- are the prefix forms
+            if (op->d_value == "+" || op->d_value == "-") {
+                op->d_unary = true;
+                op->d_leftAssociative = false;
+                op->d_precedence = UNARY_OPERATOR_PRECEDENCE;
+            }
+
+            if (op->d_unary) {
+                if (!parseExpression(op->d_precedence))
+                    return false;
+
+                d_outputStack.push(op);
+                return true;
+            }
+        }
+
+        std::cout << "Unexpected token: " << token->toString() << "\n";
+        return false;
+    }
+
+    const std::vector<TokenRef>&    d_tokens;
+    std::stack<TokenRef>&           d_outputStack;
+    size_t                          d_position = 0;
+};
+
+std::stack<TokenRef> precedenceClimbingAlgorithm(std::vector<TokenRef>& inputQueue) {
+    std::stack<TokenRef> outputStack;
+    PrecedenceClimbingParser parser(inputQueue, outputStack);
+
+    if (!parser.parse())
+        return {};
+
+    inputQueue.clear();
+    return outputStack;
 }
 
-void printOutputExpressionStack(std::stack<TokenRef> expressionStack) {
-    std::cout << "----- Expression Output Stack -----\n";
-    while (!expressionStack.empty()) {
-        std::cout << expressionStack.top()->toString() << "\n";
-        expressionStack.pop();
+enum class ParserBackend {
+    ShuntingYard,
+    PrecedenceClimbing
+};
+
+std::stack<TokenRef> parseTokens(std::vector<TokenRef>& inputQueue, ParserBackend backend) {
+    if (backend == ParserBackend::PrecedenceClimbing)
+        return precedenceClimbingAlgorithm(inputQueue);
+
+    return shuntingYardAlgorithm(inputQueue);
+}
+
+using VariableBindings = std::unordered_map<std::string, int64_t>;
+
+// Truncating division that yields 0 instead of trapping on
+// a zero divisor or on the INT64_MIN / -1 overflow case.
+inline int64_t divideIntegers(int64_t lhs, int64_t rhs) {
+    if (rhs == 0)
+        return 0;
+    if (rhs == -1)
+        return static_cast<int64_t>(0 - static_cast<uint64_t>(lhs));
+
+    return lhs / rhs;
+}
+
+// Integer power by repeated squaring, wrapping on overflow. A negative exponent
+// truncates 1 / lhs^-rhs like division does, so only 1 and -1 give non-zero results.
+inline int64_t powerIntegers(int64_t lhs, int64_t rhs) {
+    if (rhs < 0) {
+        if (lhs == 1)
+            return 1;
+        if (lhs == -1)
+            return (rhs & 1) ? -1 : 1;
+        return 0;
     }
-    std::cout << "\n";
+
+    uint64_t base = static_cast<uint64_t>(lhs);
+    uint64_t result = 1;
+    for (uint64_t exponent = static_cast<uint64_t>(rhs); exponent; exponent >>= 1) {
+        if (exponent & 1)
+            result *= base;
+        base *= base;
+    }
+
+    return static_cast<int64_t>(result);
+}
+
+// Small constant exponents as straight multiply chains
+inline int64_t powerConstant(int64_t value, int64_t exponent) {
+    uint64_t x = static_cast<uint64_t>(value);
+    switch (exponent) {
+    case 0:     return 1;
+    case 1:     return value;
+    case 2:     return static_cast<int64_t>(x * x);
+    case 3:     return static_cast<int64_t>(x * x * x);
+    case 4:     { uint64_t square = x * x; return static_cast<int64_t>(square * square); }
+    default:    return powerIntegers(value, exponent);
+    }
+}
+
+// Remainder matching divideIntegers, 0 for a zero divisor and for INT64_MIN % -1
+inline int64_t moduloIntegers(int64_t lhs, int64_t rhs) {
+    if (rhs == 0 || rhs == -1)
+        return 0;
+
+    return lhs % rhs;
+}
+
+// Shift counts use their low 6 bits, so every count is defined. Right shifts are arithmetic.
+inline int64_t shiftLeft(int64_t lhs, int64_t rhs) {
+    return static_cast<int64_t>(static_cast<uint64_t>(lhs) << (rhs & 63));
+}
+
+inline int64_t shiftRight(int64_t lhs, int64_t rhs) {
+    return lhs >> (rhs & 63);
 }
 
-int main() {
+// Fixed-point decimals are integers scaled by 10^scale. Products and quotients are
+// computed exactly in double width and rounded once, by the format's rounding mode.
+enum class DecimalRounding : uint8_t {
+    HalfEven,   // Ties to the even neighbour
+    HalfUp,     // Ties away from zero
+    Truncate,   // Towards zero
+    Floor,
+    Ceiling
+};
+
+constexpr uint32_t DECIMAL_ROUNDING_MODES = 5;
+constexpr uint32_t MAX_DECIMAL_SCALE_64 = 18;
+constexpr uint32_t MAX_DECIMAL_SCALE_128 = 38;
+
+struct DecimalFormat {
+    uint32_t        d_scale = 2;
+    DecimalRounding d_rounding = DecimalRounding::HalfEven;
+};
+
+// Decimal instructions carry their format in d_operand
+inline int64_t encodeDecimalFormat(const DecimalFormat& format) {
+    return static_cast<int64_t>(format.d_scale * DECIMAL_ROUNDING_MODES + static_cast<uint32_t>(format.d_rounding));
+}
+
+inline DecimalFormat decodeDecimalFormat(int64_t operand) {
+    return { static_cast<uint32_t>(operand / DECIMAL_ROUNDING_MODES),
+             static_cast<DecimalRounding>(operand % DECIMAL_ROUNDING_MODES) };
+}
+
+struct DecimalUnits {
+    __int128 d_units[MAX_DECIMAL_SCALE_128 + 1];
+
+    constexpr DecimalUnits() : d_units() {
+        d_units[0] = 1;
+        for (uint32_t scale = 1; scale <= MAX_DECIMAL_SCALE_128; ++scale)
+            d_units[scale] = d_units[scale - 1] * 10;
+    }
+};
+
+constexpr DecimalUnits DECIMAL_UNITS;
+
+// 10^scale, the representation of 1
+template <typename Value>
+inline Value decimalUnit(uint32_t scale) {
+    return static_cast<Value>(DECIMAL_UNITS.d_units[scale]);
+}
+
+// Rounds the magnitude 'quotient' + 'remainder' / 'divisor' of a result with the given sign
+template <typename Magnitude>
+inline Magnitude roundMagnitude(Magnitude quotient, Magnitude remainder, Magnitude divisor,
+                                bool negative, DecimalRounding rounding) {
+    if (remainder == 0)
+        return quotient;
+
+    switch (rounding) {
+    case DecimalRounding::HalfEven:
+        if (remainder != divisor - remainder)
+            return quotient + (remainder > divisor - remainder);
+        return quotient + (quotient & 1);
+    case DecimalRounding::HalfUp:   return quotient + (remainder >= divisor - remainder);
+    case DecimalRounding::Truncate: return quotient;
+    case DecimalRounding::Floor:    return quotient + negative;
+    case DecimalRounding::Ceiling:  return quotient + !negative;
+    }
+
+    return quotient;
+}
+
+// round(lhs * rhs / divisor), wrapping to 64 bits like the integer operators and
+// 0 for a zero divisor. The product is exact in 128 bits.
+inline int64_t multiplyDivide(int64_t lhs, int64_t rhs, int64_t divisor, DecimalRounding rounding) {
+    if (divisor == 0)
+        return 0;
+
+    auto magnitude = [](int64_t value) { return value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value); };
+    bool negative = ((lhs < 0) != (rhs < 0)) != (divisor < 0);
+    unsigned __int128 product = static_cast<unsigned __int128>(magnitude(lhs)) * magnitude(rhs);
+    uint64_t d = magnitude(divisor);
+
+    // Divisors are powers of ten or other decimals, both fit in 64 bits
+    unsigned __int128 quotient = roundMagnitude<unsigned __int128>(product / d, product % d, d, negative, rounding);
+    uint64_t result = static_cast<uint64_t>(quotient);
+    return static_cast<int64_t>(negative ? 0 - result : result);
+}
+
+// The 128-bit version forms the 256-bit product from 64-bit limbs and divides it by shifting
+// and subtracting, only when the product does not already fit in 128 bits.
+inline __int128 multiplyDivide(__int128 lhs, __int128 rhs, __int128 divisor, DecimalRounding rounding) {
+    using u128 = unsigned __int128;
+    if (divisor == 0)
+        return 0;
+
+    auto magnitude = [](__int128 value) { return value < 0 ? 0 - static_cast<u128>(value) : static_cast<u128>(value); };
+    bool negative = ((lhs < 0) != (rhs < 0)) != (divisor < 0);
+    u128 a = magnitude(lhs), b = magnitude(rhs), d = magnitude(divisor);
+
+    u128 a0 = static_cast<uint64_t>(a), a1 = a >> 64;
+    u128 b0 = static_cast<uint64_t>(b), b1 = b >> 64;
+    u128 middle = ((a0 * b0) >> 64) + static_cast<uint64_t>(a0 * b1) + static_cast<uint64_t>(a1 * b0);
+    u128 low = (middle << 64) | static_cast<uint64_t>(a0 * b0);
+    u128 high = a1 * b1 + ((a0 * b1) >> 64) + ((a1 * b0) >> 64) + (middle >> 64);
+
+    u128 quotient = 0, remainder = 0;
+    if (high == 0) {
+        quotient = low / d;
+        remainder = low % d;
+    } else {
+        // Quotient bits above 128 wrap away, so only the high half modulo d matters
+        remainder = high % d;
+        for (int bit = 127; bit >= 0; --bit) {
+            bool carry = (remainder >> 127) != 0;
+            remainder = (remainder << 1) | ((low >> bit) & 1);
+            quotient <<= 1;
+            if (carry || remainder >= d) {
+                remainder -= d;
+                quotient |= 1;
+            }
+        }
+    }
+
+    quotient = roundMagnitude(quotient, remainder, d, negative, rounding);
+    return static_cast<__int128>(negative ? 0 - quotient : quotient);
+}
+
+// Decimal * and / keep the scale: a * b / unit and a * unit / b
+template <typename Value>
+inline Value multiplyDecimals(Value lhs, Value rhs, const DecimalFormat& format) {
+    return multiplyDivide(lhs, rhs, decimalUnit<Value>(format.d_scale), format.d_rounding);
+}
+
+template <typename Value>
+inline Value divideDecimals(Value lhs, Value rhs, const DecimalFormat& format) {
+    return multiplyDivide(lhs, decimalUnit<Value>(format.d_scale), rhs, format.d_rounding);
+}
+
+// Scalar semantics shared by the evaluators: + - * ** << and negation wrap on overflow,
+// comparisons and logical not produce 0 or 1.
+inline int64_t applyUnaryOperator(OpCode opcode, int64_t value) {
+    switch (opcode) {
+    case OpCode::Negate:        return static_cast<int64_t>(0 - static_cast<uint64_t>(value));
+    case OpCode::LogicalNot:    return value == 0;
+    case OpCode::BitwiseNot:    return ~value;
+    default:                    return value;
+    }
+}
+
+inline int64_t applyBinaryOperator(OpCode opcode, int64_t lhs, int64_t rhs) {
+    switch (opcode) {
+    case OpCode::Add:           return static_cast<int64_t>(static_cast<uint64_t>(lhs) + static_cast<uint64_t>(rhs));
+    case OpCode::Subtract:      return static_cast<int64_t>(static_cast<uint64_t>(lhs) - static_cast<uint64_t>(rhs));
+    case OpCode::Multiply:      return static_cast<int64_t>(static_cast<uint64_t>(lhs) * static_cast<uint64_t>(rhs));
+    case OpCode::Divide:        return divideIntegers(lhs, rhs);
+    case OpCode::Power:         return powerIntegers(lhs, rhs);
+    case OpCode::Modulo:        return moduloIntegers(lhs, rhs);
+    case OpCode::BitwiseAnd:    return lhs & rhs;
+    case OpCode::BitwiseOr:     return lhs | rhs;
+    case OpCode::BitwiseXor:    return lhs ^ rhs;
+    case OpCode::ShiftLeft:     return shiftLeft(lhs, rhs);
+    case OpCode::ShiftRight:    return shiftRight(lhs, rhs);
+    case OpCode::Less:          return lhs < rhs;
+    case OpCode::LessEqual:     return lhs <= rhs;
+    case OpCode::Greater:       return lhs > rhs;
+    case OpCode::GreaterEqual:  return lhs >= rhs;
+    case OpCode::Equal:         return lhs == rhs;
+    case OpCode::NotEqual:      return lhs != rhs;
+    default:                    return 0;
+    }
+}
+
+int64_t evaluateTokens(std::stack<TokenRef>& expressionStack, const VariableBindings* variables, bool& failed) {
+    auto token = expressionStack.top();
+    expressionStack.pop();
+
+    if (token->type() == TokenType::Number) {
+        if (as<NumberToken>(token)->isFractional()) {
+            std::cout << "Decimal literal in integer expression: " << token->d_value << "\n";
+            failed = true;
+            return 0;
+        }
+
+        return as<NumberToken>(token)->getIntValue();
+    }
+
+    if (token->type() == TokenType::Variable) {
+        auto& name = as<VariableToken>(token)->name();
+        if (variables) {
+            auto it = variables->find(name);
+            if (it != variables->end())
+                return it->second;
+        }
+
+        std::cout << "Unbound variable: " << name << "\n";
+        return 0;
+    }
+
+    if (token->type() == TokenType::Operator) {
+        if (as<OperatorToken>(token)->d_unary) {
+            int64_t rhs = evaluateTokens(expressionStack, variables, failed);
+            if (token->d_value == "!")
+                return static_cast<int64_t>(!static_cast<bool>(rhs));
+            else if (token->d_value == "~")
+                return ~rhs;
+            else if (token->d_value == "+")
+                return rhs;
+            else if (token->d_value == "-")
+                return applyUnaryOperator(OpCode::Negate, rhs);
+        } else {
+            int64_t rhs = evaluateTokens(expressionStack, variables, failed);
+            int64_t lhs = evaluateTokens(expressionStack, variables, failed);
+
+            if (token->d_value == "+")
+                return applyBinaryOperator(OpCode::Add, lhs, rhs);
+            else if (token->d_value == "-")
+                return applyBinaryOperator(OpCode::Subtract, lhs, rhs);
+            else if (token->d_value == "*")
+                return applyBinaryOperator(OpCode::Multiply, lhs, rhs);
+            else if (token->d_value == "/")
+                return divideIntegers(lhs, rhs);
+            else if (token->d_value == "%")
+                return moduloIntegers(lhs, rhs);
+            else if (token->d_value == "**")
+                return powerIntegers(lhs, rhs);
+            else if (token->d_value == "&")
+                return lhs & rhs;
+            else if (token->d_value == "|")
+                return lhs | rhs;
+            else if (token->d_value == "^")
+                return lhs ^ rhs;
+            else if (token->d_value == "<<")
+                return shiftLeft(lhs, rhs);
+            else if (token->d_value == ">>")
+                return shiftRight(lhs, rhs);
+            else if (token->d_value == "<")
+                return lhs < rhs;
+            else if (token->d_value == "<=")
+                return lhs <= rhs;
+            else if (token->d_value == ">")
+                return lhs > rhs;
+            else if (token->d_value == ">=")
+                return lhs >= rhs;
+            else if (token->d_value == "==")
+                return lhs == rhs;
+            else if (token->d_value == "!=")
+                return lhs != rhs;
+        }
+    }
+
+    std::cout << "Error evaluating token: " << token->toString() << "\n";
+    failed = true;
+    return 0;
+}
+
+// Unbound variables evaluate as 0. 'failed' is set, and 0 returned, when a token cannot be
+// evaluated at all, such as a decimal literal.
+int64_t evaluateExpressionTokens(std::stack<TokenRef>& expressionStack, const VariableBindings* variables = nullptr,
+                                 bool* failed = nullptr) {
+    bool tokenFailed = false;
+    int64_t result = evaluateTokens(expressionStack, variables, tokenFailed);
+    if (failed)
+        *failed = tokenFailed;
+
+    return tokenFailed ? 0 : result;
+}
+
+void printOutputExpressionStack(std::stack<TokenRef> expressionStack) {
+    std::cout << "----- Expression Output Stack -----\n";
+    while (!expressionStack.empty()) {
+        std::cout << expressionStack.top()->toString() << "\n";
+        expressionStack.pop();
+    }
+    std::cout << "\n";
+}
+
+/*
+    Compiled expressions
+
+    The output stack of the shunting yard algorithm is flattened into a linear
+    postfix program with the operator strings resolved to opcodes once, so the
+    evaluators no longer walk the token graph or compare strings per row.
+*/
+
+struct Instruction {
+    OpCode  d_opcode;
+    int64_t d_operand; // Constant value or variable slot
+};
+
+struct CompiledExpression {
+    std::vector<Instruction> d_code;
+    std::vector<std::string> d_variables;   // Variable slot -> name
+    std::vector<uint32_t>    d_symbols;     // Variable slot -> symbol table ID
+    size_t                   d_maxStackDepth = 0;
+    size_t                   d_literalCount = 0;    // PushLiteral operands, 0 unless literals were lifted
+
+    bool valid() const { return !d_code.empty(); }
+
+    int64_t variableSlot(uint32_t symbol) const {
+        for (size_t i = 0; i < d_symbols.size(); ++i) {
+            if (d_symbols[i] == symbol)
+                return static_cast<int64_t>(i);
+        }
+
+        return -1;
+    }
+
+    // Variables without a symbol ID are found by name
+    int64_t variableSlot(const VariableToken& variable) const {
+        if (variable.d_symbol != SymbolTable::NO_SYMBOL)
+            return variableSlot(variable.d_symbol);
+
+        for (size_t i = 0; i < d_symbols.size(); ++i) {
+            if (d_symbols[i] == SymbolTable::NO_SYMBOL && d_variables[i] == variable.d_value)
+                return static_cast<int64_t>(i);
+        }
+
+        return -1;
+    }
+};
+
+inline size_t operandCount(OpCode opcode) {
+    switch (opcode) {
+    case OpCode::PushConstant:
+    case OpCode::PushVariable:
+    case OpCode::PushLiteral:
+        return 0;
+    case OpCode::Negate:
+    case OpCode::LogicalNot:
+    case OpCode::BitwiseNot:
+    case OpCode::PowerConstant:
+    case OpCode::DecimalScale:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+// Checks up front that every instruction finds its operands on the stack, that exactly one
+// value is left at the end and that variable slots are in range, and records the exact operand
+// stack depth the program needs. The evaluators rely on this and do no checks of their own.
+bool validateCompiledExpression(CompiledExpression& program) {
+    size_t depth = 0;
+    program.d_maxStackDepth = 0;
+
+    for (auto& instruction : program.d_code) {
+        size_t operands = operandCount(instruction.d_opcode);
+        if (depth < operands)
+            return false;
+
+        if (instruction.d_opcode == OpCode::PushVariable &&
+            (instruction.d_operand < 0 || static_cast<size_t>(instruction.d_operand) >= program.d_variables.size()))
+            return false;
+
+        if (instruction.d_opcode == OpCode::PushLiteral &&
+            (instruction.d_operand < 0 || static_cast<size_t>(instruction.d_operand) >= program.d_literalCount))
+            return false;
+
+        depth = depth - operands + 1;
+        program.d_maxStackDepth = std::max(program.d_maxStackDepth, depth);
+    }
+
+    // A well-formed expression leaves exactly one value on the stack
+    return depth == 1;
+}
+
+// With 'liftLiterals' every number becomes a PushLiteral of its position among the
+// expression's literals, so the program only depends on the expression's shape.
+CompiledExpression compileExpression(std::stack<TokenRef> expressionStack, bool liftLiterals = false) {
+    // The bottom of the output stack is the first postfix token
+    std::vector<TokenRef> postfix;
+    postfix.reserve(expressionStack.size());
+    while (!expressionStack.empty()) {
+        postfix.push_back(expressionStack.top());
+        expressionStack.pop();
+    }
+    std::reverse(postfix.begin(), postfix.end());
+
+    CompiledExpression program;
+
+    for (auto& token : postfix) {
+        if (token->type() == TokenType::Number) {
+            if (!liftLiterals && as<NumberToken>(token)->isFractional()) {
+                std::cout << "Decimal literal in integer expression: " << token->d_value << "\n";
+                return {};
+            }
+
+            if (liftLiterals)
+                program.d_code.push_back({ OpCode::PushLiteral, static_cast<int64_t>(program.d_literalCount++) });
+            else
+                program.d_code.push_back({ OpCode::PushConstant, as<NumberToken>(token)->getIntValue() });
+            continue;
+        }
+
+        if (token->type() == TokenType::Variable) {
+            auto variable = as<VariableToken>(token);
+            auto slot = program.variableSlot(*variable);
+            if (slot < 0) {
+                slot = static_cast<int64_t>(program.d_variables.size());
+                program.d_variables.push_back(variable->name());
+                program.d_symbols.push_back(variable->d_symbol);
+            }
+
+            program.d_code.push_back({ OpCode::PushVariable, slot });
+            continue;
+        }
+
+        if (token->type() == TokenType::Operator) {
+            auto op = as<OperatorToken>(token);
+
+            if (op->d_unary) {
+                auto info = lookupOperator(op->d_value);
+                if (op->d_value == "-")
+                    program.d_code.push_back({ OpCode::Negate, 0 });
+                else if (info && info->d_unary)
+                    program.d_code.push_back({ info->d_opcode, 0 });
+                else if (op->d_value != "+") {
+                    std::cout << "Error compiling token: " << token->toString() << "\n";
+                    return {};
+                }
+
+                continue;
+            }
+
+            auto info = lookupOperator(op->d_value);
+            if (!info || info->d_unary) {
+                std::cout << "Error compiling token: " << token->toString() << "\n";
+                return {};
+            }
+
+            // A constant exponent is the whole right operand, fold it into a specialized power
+            if (info->d_opcode == OpCode::Power && !program.d_code.empty() &&
+                program.d_code.back().d_opcode == OpCode::PushConstant) {
+                program.d_code.back().d_opcode = OpCode::PowerConstant;
+                continue;
+            }
+
+            program.d_code.push_back({ info->d_opcode, 0 });
+            continue;
+        }
+
+        std::cout << "Error compiling token: " << token->toString() << "\n";
+        return {};
+    }
+
+    if (!validateCompiledExpression(program)) {
+        std::cout << "Malformed expression error!\n";
+        return {};
+    }
+
+    return program;
+}
+
+/*
+    Scalar evaluation
+
+    Evaluates a validated program for a single row. The operand stack depth is
+    known from validation, so the stack is a fixed array on the native stack
+    (or a reused thread-local buffer for unusually deep programs) and pushes
+    and pops are plain pointer moves without bounds or underflow checks.
+*/
+
+constexpr size_t INLINE_STACK_DEPTH = 32;
+
+// The top of the operand stack lives in a local variable ('top') so it stays in a register,
+// which makes a binary operator one load instead of two loads and a store. The stack array
+// holds everything below the top; the first push spills an unused value into slot 0.
+inline int64_t runInstructions(const Instruction* code, size_t count, const int64_t* variables, int64_t* stack,
+                               const int64_t* literals = nullptr) {
+    int64_t top = 0;
+    size_t size = 0;
+
+    for (const Instruction* end = code + count; code != end; ++code) {
+        auto& instruction = *code;
+        switch (instruction.d_opcode) {
+        case OpCode::PushConstant:
+            stack[size++] = top;
+            top = instruction.d_operand;
+            break;
+        case OpCode::PushVariable:
+            stack[size++] = top;
+            top = variables[instruction.d_operand];
+            break;
+        case OpCode::PushLiteral:
+            stack[size++] = top;
+            top = literals[instruction.d_operand];
+            break;
+        case OpCode::Negate:
+        case OpCode::LogicalNot:
+        case OpCode::BitwiseNot:
+            top = applyUnaryOperator(instruction.d_opcode, top);
+            break;
+        case OpCode::PowerConstant:
+            top = powerConstant(top, instruction.d_operand);
+            break;
+        case OpCode::DecimalScale:
+            top *= decimalUnit<int64_t>(decodeDecimalFormat(instruction.d_operand).d_scale);
+            break;
+        case OpCode::DecimalMultiply:
+            top = multiplyDecimals(stack[--size], top, decodeDecimalFormat(instruction.d_operand));
+            break;
+        case OpCode::DecimalDivide:
+            top = divideDecimals(stack[--size], top, decodeDecimalFormat(instruction.d_operand));
+            break;
+        default:
+            top = applyBinaryOperator(instruction.d_opcode, stack[--size], top);
+            break;
+        }
+    }
+
+    return top;
+}
+
+// Programs with lifted literals need their literal array, so they cannot run through the
+// entry points below that take none
+inline int64_t runProgram(const CompiledExpression& program, const int64_t* variables, int64_t* stack) {
+    assert(program.d_literalCount == 0 && "lifted program run without its literals");
+    return runInstructions(program.d_code.data(), program.d_code.size(), variables, stack);
+}
+
+// Plain memory stack interpreter without top-of-stack caching, kept as the benchmark baseline.
+// Only runs integer programs without lifted literals.
+inline int64_t runProgramUncached(const CompiledExpression& program, const int64_t* variables, int64_t* stack) {
+    assert(program.d_literalCount == 0 && "lifted program run without its literals");
+    size_t size = 0;
+
+    for (auto& instruction : program.d_code) {
+        switch (instruction.d_opcode) {
+        case OpCode::PushConstant:
+            stack[size++] = instruction.d_operand;
+            break;
+        case OpCode::PushVariable:
+            stack[size++] = variables[instruction.d_operand];
+            break;
+        case OpCode::Negate:
+        case OpCode::LogicalNot:
+        case OpCode::BitwiseNot:
+            stack[size - 1] = applyUnaryOperator(instruction.d_opcode, stack[size - 1]);
+            break;
+        case OpCode::PowerConstant:
+            stack[size - 1] = powerConstant(stack[size - 1], instruction.d_operand);
+            break;
+        default:
+            --size;
+            stack[size - 1] = applyBinaryOperator(instruction.d_opcode, stack[size - 1], stack[size]);
+            break;
+        }
+    }
+
+    return stack[0];
+}
+
+// Evaluates validated code needing at most 'maxStackDepth' operand stack entries,
+// 'literals' is only read by code with lifted literals
+int64_t evaluateInstructions(const Instruction* code, size_t count, size_t maxStackDepth, const int64_t* variables,
+                             const int64_t* literals = nullptr) {
+    if (count == 0)
+        return 0;
+
+    if (maxStackDepth <= INLINE_STACK_DEPTH) {
+        int64_t stack[INLINE_STACK_DEPTH];
+        return runInstructions(code, count, variables, stack, literals);
+    }
+
+    thread_local std::vector<int64_t> deepStack;
+    if (deepStack.size() < maxStackDepth)
+        deepStack.resize(maxStackDepth);
+
+    return runInstructions(code, count, variables, deepStack.data(), literals);
+}
+
+// 'variables' holds one value per variable slot of the program
+int64_t evaluateCompiledExpression(const CompiledExpression& program, const int64_t* variables) {
+    assert(program.d_literalCount == 0 && "lifted program run without its literals");
+    return evaluateInstructions(program.d_code.data(), program.d_code.size(), program.d_maxStackDepth, variables);
+}
+
+// Orders values indexed by symbol table ID by variable slot, without any string lookups
+std::vector<int64_t> bindVariables(const CompiledExpression& program, const std::vector<int64_t>& valuesBySymbol) {
+    std::vector<int64_t> values(program.d_symbols.size(), 0);
+
+    for (size_t slot = 0; slot < values.size(); ++slot) {
+        if (program.d_symbols[slot] < valuesBySymbol.size())
+            values[slot] = valuesBySymbol[program.d_symbols[slot]];
+    }
+
+    return values;
+}
+
+// Orders the bound values by variable slot, unbound variables evaluate as 0
+std::vector<int64_t> bindVariables(const CompiledExpression& program, const VariableBindings& variables) {
+    std::vector<int64_t> values(program.d_variables.size(), 0);
+
+    for (size_t slot = 0; slot < values.size(); ++slot) {
+        auto it = variables.find(program.d_variables[slot]);
+        if (it == variables.end())
+            std::cout << "Unbound variable: " << program.d_variables[slot] << "\n";
+        else
+            values[slot] = it->second;
+    }
+
+    return values;
+}
+
+/*
+    Literal lifting
+
+    Expressions that differ only in their numeric literals share one compiled
+    program. The postfix output of the parser is reduced to a shape key, with
+    every number replaced by a placeholder, and the literals are collected into
+    a per-expression array in postfix order. A shape is compiled once, with its
+    numbers turned into PushLiteral instructions, and every expression of that
+    shape evaluates the shared program against its own literal array.
+*/
+
+struct LiftedExpression {
+    std::shared_ptr<const CompiledExpression>   d_shape;
+    std::vector<int64_t>                        d_literals;
+    uint32_t                                    d_shapeId = 0;  // Dense index of the shape in its cache
+
+    bool valid() const { return d_shape != nullptr; }
+};
+
+// Appends the literal-free shape of a postfix expression to 'key' and its numbers to 'literals',
+// returns false on a decimal literal
+bool liftLiterals(const std::vector<TokenRef>& postfix, std::string& key, std::vector<int64_t>& literals) {
+    for (auto& token : postfix) {
+        if (token->type() == TokenType::Number) {
+            if (as<NumberToken>(token)->isFractional()) {
+                std::cout << "Decimal literal in integer expression: " << token->d_value << "\n";
+                return false;
+            }
+
+            literals.push_back(as<NumberToken>(token)->getIntValue());
+            key += '#';
+        } else {
+            key += token->type() == TokenType::Variable ? as<VariableToken>(token)->name() : token->d_value;
+            if (token->type() == TokenType::Operator && as<OperatorToken>(token)->d_unary)
+                key += 'u';
+        }
+        key += ' ';
+    }
+
+    return true;
+}
+
+class ShapeCache {
+public:
+    // Returns an invalid expression if it is malformed
+    LiftedExpression compile(const std::string& expression) {
+        std::vector<TokenRef> postfix;
+        ShuntingYard parser([&postfix](const TokenRef& token) { postfix.push_back(token); });
+        for (auto& token : tokenizeExpression(expression)) {
+            if (!parser.push(token))
+                return {};
+        }
+        if (!parser.finish())
+            return {};
+
+        LiftedExpression lifted;
+        std::string key;
+        if (!liftLiterals(postfix, key, lifted.d_literals))
+            return {};
+
+        std::lock_guard<std::mutex> lock(d_mutex);
+        auto it = d_shapes.find(key);
+        if (it == d_shapes.end()) {
+            std::stack<TokenRef> expressionStack;
+            for (auto& token : postfix)
+                expressionStack.push(token);
+
+            auto program = compileExpression(std::move(expressionStack), true);
+            if (!program.valid())
+                return {};
+
+            auto shape = std::make_shared<const CompiledExpression>(std::move(program));
+            it = d_shapes.emplace(std::move(key), std::make_pair(shape, static_cast<uint32_t>(d_shapes.size()))).first;
+        }
+
+        lifted.d_shape = it->second.first;
+        lifted.d_shapeId = it->second.second;
+        return lifted;
+    }
+
+    size_t shapeCount() const {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        return d_shapes.size();
+    }
+
+private:
+    using Shape = std::pair<std::shared_ptr<const CompiledExpression>, uint32_t>;
+
+    mutable std::mutex                      d_mutex;
+    std::unordered_map<std::string, Shape>  d_shapes;
+};
+
+// 'variables' holds one value per variable slot of the shape
+int64_t evaluateLiftedExpression(const LiftedExpression& expression, const int64_t* variables) {
+    auto& shape = *expression.d_shape;
+    return evaluateInstructions(shape.d_code.data(), shape.d_code.size(), shape.d_maxStackDepth,
+                                variables, expression.d_literals.data());
+}
+
+/*
+    Batch evaluation
+
+    Rows are processed in blocks of at most BATCH_BLOCK_SIZE. Every instruction
+    runs over the whole block before the next one starts, so each operand stack
+    slot is a small column of values and the per-opcode loops are tight and
+    branch-free enough for the compiler to vectorize.
+
+    Deep programs get smaller blocks so all their live stack columns stay in
+    cache (see batchBlockSize), and loading a variable prefetches the same
+    column's rows for the next block while the current one is computed.
+*/
+
+constexpr size_t BATCH_BLOCK_SIZE = 1024;
+constexpr size_t BATCH_MIN_BLOCK_SIZE = 64;
+constexpr size_t BATCH_CACHE_BYTES = 128 * 1024;    // Half of a typical per-core L2
+constexpr size_t CACHE_LINE_BYTES = 64;
+
+// Largest power-of-two block whose stack columns fit in BATCH_CACHE_BYTES. Block sizes
+// always divide BATCH_BLOCK_SIZE, so ranges aligned to it stay aligned to any block.
+inline size_t batchBlockSize(const CompiledExpression& program) {
+    size_t blockSize = BATCH_BLOCK_SIZE;
+    while (blockSize > BATCH_MIN_BLOCK_SIZE && program.d_maxStackDepth * blockSize * sizeof(int64_t) > BATCH_CACHE_BYTES)
+        blockSize /= 2;
+
+    return blockSize;
+}
+
+inline void prefetchColumn(const int64_t* begin, size_t count) {
+#if defined(__GNUC__)
+    const char* bytes = reinterpret_cast<const char*>(begin);
+    for (size_t offset = 0; offset < count * sizeof(int64_t); offset += CACHE_LINE_BYTES)
+        __builtin_prefetch(bytes + offset);
+#else
+    (void)begin;
+    (void)count;
+#endif
+}
+
+struct ColumnBatch {
+    std::vector<const int64_t*> d_columns;  // Indexed by variable slot
+    size_t                      d_rowCount = 0;
+    const int64_t*              d_literals = nullptr;   // For programs with lifted literals
+};
+
+using SelectionVector = std::vector<uint32_t>;
+using Bitmask = std::vector<uint64_t>;
+
+template <typename Fn>
+inline void applyUnaryKernel(int64_t* values, size_t count, Fn fn) {
+    for (size_t i = 0; i < count; ++i)
+        values[i] = fn(values[i]);
+}
+
+template <typename Fn>
+inline void applyBinaryKernel(int64_t* lhs, const int64_t* rhs, size_t count, Fn fn) {
+    for (size_t i = 0; i < count; ++i)
+        lhs[i] = fn(lhs[i], rhs[i]);
+}
+
+// Evaluates 'count' rows and returns the scratch slot holding their results. The rows are
+// either the dense range starting at 'rowBegin' or, when 'selection' is given, the listed row indices.
+const int64_t* runBlock(const CompiledExpression& program, const ColumnBatch& batch,
+                        size_t rowBegin, size_t count, const uint32_t* selection, int64_t* scratch) {
+    assert((program.d_literalCount == 0 || batch.d_literals) && "lifted program run without its literals");
+    const size_t stride = batchBlockSize(program);
+    int64_t* top = scratch - stride;
+
+    for (auto& instruction : program.d_code) {
+        switch (instruction.d_opcode) {
+        case OpCode::PushConstant:
+            top += stride;
+            std::fill(top, top + count, instruction.d_operand);
+            break;
+        case OpCode::PushLiteral:
+            top += stride;
+            std::fill(top, top + count, batch.d_literals[instruction.d_operand]);
+            break;
+        case OpCode::PushVariable: {
+            top += stride;
+            const int64_t* column = batch.d_columns[instruction.d_operand];
+            if (selection) {
+                for (size_t i = 0; i < count; ++i)
+                    top[i] = column[selection[i]];
+            } else {
+                size_t next = rowBegin + count;
+                if (next < batch.d_rowCount)
+                    prefetchColumn(column + next, std::min(count, batch.d_rowCount - next));
+                std::copy(column + rowBegin, column + rowBegin + count, top);
+            }
+            break;
+        }
+        case OpCode::Negate:
+            applyUnaryKernel(top, count, [](int64_t v) { return static_cast<int64_t>(0 - static_cast<uint64_t>(v)); });
+            break;
+        case OpCode::LogicalNot:
+            applyUnaryKernel(top, count, [](int64_t v) -> int64_t { return v == 0; });
+            break;
+        case OpCode::BitwiseNot:
+            applyUnaryKernel(top, count, [](int64_t v) { return ~v; });
+            break;
+        case OpCode::PowerConstant:
+            // One kernel per common exponent so the multiply chain is unrolled and vectorized
+            switch (instruction.d_operand) {
+            case 2:
+                applyUnaryKernel(top, count, [](int64_t v) { return powerConstant(v, 2); });
+                break;
+            case 3:
+                applyUnaryKernel(top, count, [](int64_t v) { return powerConstant(v, 3); });
+                break;
+            case 4:
+                applyUnaryKernel(top, count, [](int64_t v) { return powerConstant(v, 4); });
+                break;
+            default: {
+                int64_t exponent = instruction.d_operand;
+                applyUnaryKernel(top, count, [exponent](int64_t v) { return powerIntegers(v, exponent); });
+                break;
+            }
+            }
+            break;
+        case OpCode::DecimalScale: {
+            int64_t unit = decimalUnit<int64_t>(decodeDecimalFormat(instruction.d_operand).d_scale);
+            applyUnaryKernel(top, count, [unit](int64_t v) { return v * unit; });
+            break;
+        }
+        default: {
+            int64_t* rhs = top;
+            top -= stride;
+
+            switch (instruction.d_opcode) {
+            case OpCode::Add:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)); });
+                break;
+            case OpCode::Subtract:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b)); });
+                break;
+            case OpCode::Multiply:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)); });
+                break;
+            case OpCode::Divide:
+                applyBinaryKernel(top, rhs, count, divideIntegers);
+                break;
+            case OpCode::Power:
+                applyBinaryKernel(top, rhs, count, powerIntegers);
+                break;
+            case OpCode::Modulo:
+                applyBinaryKernel(top, rhs, count, moduloIntegers);
+                break;
+            case OpCode::BitwiseAnd:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) { return a & b; });
+                break;
+            case OpCode::BitwiseOr:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) { return a | b; });
+                break;
+            case OpCode::BitwiseXor:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) { return a ^ b; });
+                break;
+            case OpCode::ShiftLeft:
+                applyBinaryKernel(top, rhs, count, shiftLeft);
+                break;
+            case OpCode::ShiftRight:
+                applyBinaryKernel(top, rhs, count, shiftRight);
+                break;
+            case OpCode::Less:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) -> int64_t { return a < b; });
+                break;
+            case OpCode::LessEqual:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) -> int64_t { return a <= b; });
+                break;
+            case OpCode::Greater:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) -> int64_t { return a > b; });
+                break;
+            case OpCode::GreaterEqual:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) -> int64_t { return a >= b; });
+                break;
+            case OpCode::Equal:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) -> int64_t { return a == b; });
+                break;
+            case OpCode::NotEqual:
+                applyBinaryKernel(top, rhs, count, [](int64_t a, int64_t b) -> int64_t { return a != b; });
+                break;
+            case OpCode::DecimalMultiply: {
+                // The unit is hoisted out of the loop, leaving one 128-bit multiply and divide per row
+                int64_t unit = decimalUnit<int64_t>(decodeDecimalFormat(instruction.d_operand).d_scale);
+                DecimalRounding rounding = decodeDecimalFormat(instruction.d_operand).d_rounding;
+                applyBinaryKernel(top, rhs, count, [unit, rounding](int64_t a, int64_t b) { return multiplyDivide(a, b, unit, rounding); });
+                break;
+            }
+            case OpCode::DecimalDivide: {
+                int64_t unit = decimalUnit<int64_t>(decodeDecimalFormat(instruction.d_operand).d_scale);
+                DecimalRounding rounding = decodeDecimalFormat(instruction.d_operand).d_rounding;
+                applyBinaryKernel(top, rhs, count, [unit, rounding](int64_t a, int64_t b) { return multiplyDivide(a, unit, b, rounding); });
+                break;
+            }
+            default:
+                break;
+            }
+            break;
+        }
+        }
+    }
+
+    return top;
+}
+
+void evaluateBlock(const CompiledExpression& program, const ColumnBatch& batch,
+                   size_t rowBegin, size_t count, const uint32_t* selection,
+                   int64_t* scratch, int64_t* results) {
+    const int64_t* values = runBlock(program, batch, rowBegin, count, selection, scratch);
+    std::copy(values, values + count, results);
+}
+
+// Evaluates the expression for every row of the batch, 'results' must hold d_rowCount values
+void evaluateBatch(const CompiledExpression& program, const ColumnBatch& batch, int64_t* results) {
+    std::vector<int64_t> scratch(program.d_maxStackDepth * BATCH_BLOCK_SIZE);
+    size_t blockSize = batchBlockSize(program);
+
+    for (size_t row = 0; row < batch.d_rowCount; row += blockSize) {
+        size_t count = std::min(blockSize, batch.d_rowCount - row);
+        evaluateBlock(program, batch, row, count, nullptr, scratch.data(), results + row);
+    }
+}
+
+// Evaluates the expression only for the selected rows, 'results' receives one value per selected row
+void evaluateBatch(const CompiledExpression& program, const ColumnBatch& batch,
+                   const SelectionVector& selection, int64_t* results) {
+    std::vector<int64_t> scratch(program.d_maxStackDepth * BATCH_BLOCK_SIZE);
+    size_t blockSize = batchBlockSize(program);
+
+    for (size_t i = 0; i < selection.size(); i += blockSize) {
+        size_t count = std::min(blockSize, selection.size() - i);
+        evaluateBlock(program, batch, 0, count, selection.data() + i, scratch.data(), results + i);
+    }
+}
+
+// Appends the rows of a block whose predicate value is non-zero, without branching per row
+inline void appendSelectedRows(const int64_t* values, const uint32_t* rows, uint32_t rowBegin,
+                               size_t count, SelectionVector& selection) {
+    size_t selected = selection.size();
+    selection.resize(selected + count);
+
+    for (size_t i = 0; i < count; ++i) {
+        selection[selected] = rows ? rows[i] : rowBegin + static_cast<uint32_t>(i);
+        selected += (values[i] != 0);
+    }
+
+    selection.resize(selected);
+}
+
+// Returns the indices of all rows for which the predicate is true
+SelectionVector filterBatch(const CompiledExpression& program, const ColumnBatch& batch) {
+    SelectionVector selection;
+    std::vector<int64_t> scratch(program.d_maxStackDepth * BATCH_BLOCK_SIZE);
+    int64_t values[BATCH_BLOCK_SIZE];
+    size_t blockSize = batchBlockSize(program);
+
+    for (size_t row = 0; row < batch.d_rowCount; row += blockSize) {
+        size_t count = std::min(blockSize, batch.d_rowCount - row);
+        evaluateBlock(program, batch, row, count, nullptr, scratch.data(), values);
+        appendSelectedRows(values, nullptr, static_cast<uint32_t>(row), count, selection);
+    }
+
+    return selection;
+}
+
+// Refines an existing selection, only the already selected rows are evaluated
+SelectionVector filterBatch(const CompiledExpression& program, const ColumnBatch& batch,
+                            const SelectionVector& inputSelection) {
+    SelectionVector selection;
+    std::vector<int64_t> scratch(program.d_maxStackDepth * BATCH_BLOCK_SIZE);
+    int64_t values[BATCH_BLOCK_SIZE];
+    size_t blockSize = batchBlockSize(program);
+
+    for (size_t i = 0; i < inputSelection.size(); i += blockSize) {
+        size_t count = std::min(blockSize, inputSelection.size() - i);
+        const uint32_t* rows = inputSelection.data() + i;
+        evaluateBlock(program, batch, 0, count, rows, scratch.data(), values);
+        appendSelectedRows(values, rows, 0, count, selection);
+    }
+
+    return selection;
+}
+
+// Returns one bit per row, set when the predicate is true
+Bitmask filterBatchBitmask(const CompiledExpression& program, const ColumnBatch& batch) {
+    Bitmask mask((batch.d_rowCount + 63) / 64, 0);
+    std::vector<int64_t> scratch(program.d_maxStackDepth * BATCH_BLOCK_SIZE);
+    int64_t values[BATCH_BLOCK_SIZE];
+
+    // Block sizes are multiples of 64, so blocks always start on a word boundary
+    size_t blockSize = batchBlockSize(program);
+    for (size_t row = 0; row < batch.d_rowCount; row += blockSize) {
+        size_t count = std::min(blockSize, batch.d_rowCount - row);
+        evaluateBlock(program, batch, row, count, nullptr, scratch.data(), values);
+
+        for (size_t i = 0; i < count; ++i)
+            mask[(row + i) / 64] |= static_cast<uint64_t>(values[i] != 0) << ((row + i) % 64);
+    }
+
+    return mask;
+}
+
+SelectionVector selectionFromBitmask(const Bitmask& mask) {
+    SelectionVector selection;
+
+    for (size_t word = 0; word < mask.size(); ++word) {
+        uint64_t bits = mask[word];
+        while (bits) {
+            selection.push_back(static_cast<uint32_t>(word * 64 + __builtin_ctzll(bits)));
+            bits &= bits - 1;
+        }
+    }
+
+    return selection;
+}
+
+/*
+    Fixed-point decimals
+
+    Decimal mode evaluates money arithmetic exactly. A value is an integer
+    scaled by 10^scale, so + - % and the comparisons are the integer
+    instructions unchanged and only * and / become DecimalMultiply and
+    DecimalDivide, which rescale through a double-width product and round once.
+    Comparisons and logical not are followed by DecimalScale so their truth
+    values are decimal ones.
+
+    Literals are scaled at compile time and lifted into the expression's
+    literal array. 64-bit programs then run on the scalar and batch
+    interpreters as they are; the 128-bit backing keeps its wider literals and
+    variables in its own scalar loop over the same instructions.
+*/
+
+template <typename Value>
+struct DecimalExpression {
+    CompiledExpression  d_program;      // Numbers are PushLiteral instructions into d_literals
+    std::vector<Value>  d_literals;
+    DecimalFormat       d_format;
+
+    bool valid() const { return d_program.valid(); }
+};
+
+using Decimal64Expression = DecimalExpression<int64_t>;
+using Decimal128Expression = DecimalExpression<__int128>;
+
+template <typename Value>
+constexpr uint32_t maxDecimalScale() {
+    return sizeof(Value) == sizeof(int64_t) ? MAX_DECIMAL_SCALE_64 : MAX_DECIMAL_SCALE_128;
+}
+
+bool parseDecimalRounding(const std::string& name, DecimalRounding& rounding) {
+    static const std::pair<const char*, DecimalRounding> names[] = {
+        { "half-even", DecimalRounding::HalfEven },
+        { "half-up",   DecimalRounding::HalfUp },
+        { "truncate",  DecimalRounding::Truncate },
+        { "floor",     DecimalRounding::Floor },
+        { "ceiling",   DecimalRounding::Ceiling },
+    };
+
+    for (auto& entry : names) {
+        if (name == entry.first) {
+            rounding = entry.second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Parses an optionally negative decimal such as "-12.345" into 'format', rounding away
+// extra fractional digits. Returns false if it is malformed or out of range.
+template <typename Value>
+bool parseDecimal(std::string_view text, const DecimalFormat& format, Value& value) {
+    bool negative = !text.empty() && text.front() == '-';
+    if (negative)
+        text.remove_prefix(1);
+
+    Value mantissa = 0;
+    uint32_t fractionDigits = 0;
+    bool fraction = false;
+    bool digits = false;
+
+    for (char c : text) {
+        if (c == '.' && !fraction) {
+            fraction = true;
+            continue;
+        }
+
+        if (!std::isdigit(static_cast<unsigned char>(c)))
+            return false;
+
+        if (__builtin_mul_overflow(mantissa, static_cast<Value>(10), &mantissa) ||
+            __builtin_add_overflow(mantissa, static_cast<Value>(c - '0'), &mantissa))
+            return false;
+
+        fractionDigits += fraction;
+        digits = true;
+    }
+
+    if (!digits)
+        return false;
+
+    if (negative)
+        mantissa = -mantissa;
+
+    if (fractionDigits <= format.d_scale)
+        return !__builtin_mul_overflow(mantissa, decimalUnit<Value>(format.d_scale - fractionDigits), &value);
+
+    // Extra digits are rounded away in 128 bits, where 10^excess fits for any excess up to 38
+    uint32_t excess = fractionDigits - format.d_scale;
+    if (excess <= MAX_DECIMAL_SCALE_128) {
+        value = static_cast<Value>(multiplyDivide(static_cast<__int128>(mantissa), static_cast<__int128>(1),
+                                                  decimalUnit<__int128>(excess), format.d_rounding));
+        return true;
+    }
+
+    // Only leading zeros make the excess larger, and then the literal is below half a unit
+    // of the scale, so it rounds to 0 or, away from zero, to one unit
+    DecimalRounding away = mantissa < 0 ? DecimalRounding::Floor : DecimalRounding::Ceiling;
+    value = mantissa != 0 && format.d_rounding == away ? (mantissa < 0 ? -1 : 1) : 0;
+    return true;
+}
+
+template <typename Value>
+std::string formatDecimal(Value value, uint32_t scale) {
+    using Magnitude = std::conditional_t<sizeof(Value) == sizeof(int64_t), uint64_t, unsigned __int128>;
+    Magnitude magnitude = value < 0 ? 0 - static_cast<Magnitude>(value) : static_cast<Magnitude>(value);
+
+    std::string digits;
+    do {
+        digits += static_cast<char>('0' + static_cast<int>(magnitude % 10));
+        magnitude /= 10;
+    } while (magnitude);
+
+    if (digits.size() <= scale)
+        digits.append(scale + 1 - digits.size(), '0');
+    std::reverse(digits.begin(), digits.end());
+
+    if (scale > 0)
+        digits.insert(digits.size() - scale, 1, '.');
+
+    return value < 0 ? "-" + digits : digits;
+}
+
+// Compiles the parser output in decimal mode, returns an invalid expression for an operator
+// without a decimal meaning (powers, shifts and bitwise operators) or an out of range literal.
+template <typename Value>
+DecimalExpression<Value> compileDecimalExpression(std::stack<TokenRef> expressionStack, const DecimalFormat& format) {
+    DecimalExpression<Value> expression;
+    expression.d_format = format;
+
+    if (format.d_scale > maxDecimalScale<Value>()) {
+        std::cout << "Decimal scale out of range: " << format.d_scale << "\n";
+        return expression;
+    }
+
+    // The bottom of the output stack is the first postfix token
+    std::vector<TokenRef> postfix;
+    for (; !expressionStack.empty(); expressionStack.pop())
+        postfix.push_back(expressionStack.top());
+    std::reverse(postfix.begin(), postfix.end());
+
+    auto isSign = [](const TokenRef& token) {
+        return token->type() == TokenType::Operator && as<OperatorToken>(token)->d_unary &&
+               (token->d_value == "-" || token->d_value == "+");
+    };
+
+    // Signs applied directly to a literal are folded into it, so Floor and Ceiling round the
+    // literal in the right direction. Numbers in postfix order are the literal array.
+    for (size_t i = 0; i < postfix.size(); ++i) {
+        expressionStack.push(postfix[i]);
+        if (postfix[i]->type() != TokenType::Number)
+            continue;
+
+        std::string text = postfix[i]->d_value;
+        bool negative = false;
+        for (; i + 1 < postfix.size() && isSign(postfix[i + 1]); ++i)
+            negative ^= postfix[i + 1]->d_value == "-";
+        if (negative)
+            text.insert(0, 1, '-');
+
+        Value value = 0;
+        if (!parseDecimal(text, format, value)) {
+            std::cout << "Decimal literal out of range: " << text << "\n";
+            return expression;
+        }
+        expression.d_literals.push_back(value);
+    }
+
+    CompiledExpression program = compileExpression(std::move(expressionStack), true);
+    if (!program.valid())
+        return expression;
+
+    std::vector<Instruction> code;
+    int64_t operand = encodeDecimalFormat(format);
+
+    for (auto& instruction : program.d_code) {
+        switch (instruction.d_opcode) {
+        case OpCode::PushVariable:
+        case OpCode::PushLiteral:
+        case OpCode::Negate:
+        case OpCode::Add:
+        case OpCode::Subtract:
+        case OpCode::Modulo:
+            code.push_back(instruction);
+            break;
+        case OpCode::Multiply:
+            code.push_back({ OpCode::DecimalMultiply, operand });
+            break;
+        case OpCode::Divide:
+            code.push_back({ OpCode::DecimalDivide, operand });
+            break;
+        case OpCode::LogicalNot:
+        case OpCode::Less:
+        case OpCode::LessEqual:
+        case OpCode::Greater:
+        case OpCode::GreaterEqual:
+        case OpCode::Equal:
+        case OpCode::NotEqual:
+            code.push_back(instruction);
+            code.push_back({ OpCode::DecimalScale, operand });
+            break;
+        default:
+            for (auto& info : OPERATOR_TABLE) {
+                if (info.d_opcode == instruction.d_opcode)
+                    std::cout << "Operator not supported in decimal mode: " << info.d_symbol << "\n";
+            }
+            return expression;
+        }
+    }
+
+    program.d_code = std::move(code);
+    validateCompiledExpression(program);
+    expression.d_program = std::move(program);
+    return expression;
+}
+
+// 'variables' holds one scaled value per variable slot of the program
+int64_t evaluateDecimal(const Decimal64Expression& expression, const int64_t* variables) {
+    auto& program = expression.d_program;
+    return evaluateInstructions(program.d_code.data(), program.d_code.size(), program.d_maxStackDepth,
+                                variables, expression.d_literals.data());
+}
+
+inline __int128 runDecimalInstructions(const Decimal128Expression& expression, const __int128* variables, __int128* stack) {
+    using u128 = unsigned __int128;
+    const __int128* literals = expression.d_literals.data();
+    __int128 top = 0;
+    size_t size = 0;
+
+    for (auto& instruction : expression.d_program.d_code) {
+        switch (instruction.d_opcode) {
+        case OpCode::PushVariable:
+            stack[size++] = top;
+            top = variables[instruction.d_operand];
+            break;
+        case OpCode::PushLiteral:
+            stack[size++] = top;
+            top = literals[instruction.d_operand];
+            break;
+        case OpCode::Negate:
+            top = static_cast<__int128>(0 - static_cast<u128>(top));
+            break;
+        case OpCode::LogicalNot:
+            top = top == 0;
+            break;
+        case OpCode::DecimalScale:
+            top *= decimalUnit<__int128>(decodeDecimalFormat(instruction.d_operand).d_scale);
+            break;
+        case OpCode::DecimalMultiply:
+            top = multiplyDecimals(stack[--size], top, decodeDecimalFormat(instruction.d_operand));
+            break;
+        case OpCode::DecimalDivide:
+            top = divideDecimals(stack[--size], top, decodeDecimalFormat(instruction.d_operand));
+            break;
+        default: {
+            __int128 lhs = stack[--size];
+            switch (instruction.d_opcode) {
+            case OpCode::Add:           top = static_cast<__int128>(static_cast<u128>(lhs) + static_cast<u128>(top)); break;
+            case OpCode::Subtract:      top = static_cast<__int128>(static_cast<u128>(lhs) - static_cast<u128>(top)); break;
+            case OpCode::Modulo:        top = (top == 0 || top == -1) ? 0 : lhs % top; break;
+            case OpCode::Less:          top = lhs < top; break;
+            case OpCode::LessEqual:     top = lhs <= top; break;
+            case OpCode::Greater:       top = lhs > top; break;
+            case OpCode::GreaterEqual:  top = lhs >= top; break;
+            case OpCode::Equal:         top = lhs == top; break;
+            case OpCode::NotEqual:      top = lhs != top; break;
+            default:                    top = 0; break;
+            }
+            break;
+        }
+        }
+    }
+
+    return top;
+}
+
+__int128 evaluateDecimal(const Decimal128Expression& expression, const __int128* variables) {
+    if (expression.d_program.d_maxStackDepth <= INLINE_STACK_DEPTH) {
+        __int128 stack[INLINE_STACK_DEPTH];
+        return runDecimalInstructions(expression, variables, stack);
+    }
+
+    std::vector<__int128> stack(expression.d_program.d_maxStackDepth);
+    return runDecimalInstructions(expression, variables, stack.data());
+}
+
+// 'batch' holds scaled columns, its literal array is replaced by the expression's
+void evaluateDecimalBatch(const Decimal64Expression& expression, ColumnBatch batch, int64_t* results) {
+    batch.d_literals = expression.d_literals.data();
+    evaluateBatch(expression.d_program, batch, results);
+}
+
+template <typename Value>
+int evaluateDecimalCommand(std::vector<TokenRef>& tokens, const DecimalFormat& format,
+                           const std::unordered_map<std::string, std::string>& bindings, ParserBackend backend) {
+    auto expression = compileDecimalExpression<Value>(parseTokens(tokens, backend), format);
+    if (!expression.valid())
+        return 1;
+
+    std::vector<Value> variables(expression.d_program.d_variables.size(), 0);
+    for (size_t slot = 0; slot < variables.size(); ++slot) {
+        auto it = bindings.find(expression.d_program.d_variables[slot]);
+        if (it == bindings.end()) {
+            std::cout << "Unbound variable: " << expression.d_program.d_variables[slot] << "\n";
+            return 1;
+        } else if (!parseDecimal(it->second, format, variables[slot])) {
+            std::cout << "Invalid decimal value: " << it->first << "=" << it->second << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "Expression result: " << formatDecimal(evaluateDecimal(expression, variables.data()), format.d_scale) << "\n";
+    return 0;
+}
+
+// 'formatSpec' is "<scale>[,<rounding>][,128]", each binding is "name=value"
+int runDecimalCommand(const std::string& formatSpec, const std::string& text,
+                      const std::vector<std::string>& bindingArgs, ParserBackend backend) {
+    DecimalFormat format;
+    bool wide = false;
+
+    std::stringstream spec(formatSpec);
+    std::string field;
+    for (size_t index = 0; std::getline(spec, field, ','); ++index) {
+        char* end = nullptr;
+        if (index == 0) {
+            format.d_scale = static_cast<uint32_t>(std::strtoul(field.c_str(), &end, 10));
+            if (field.empty() || *end != '\0') {
+                std::cout << "Invalid decimal scale: " << field << "\n";
+                return 1;
+            }
+        } else if (field == "128" || field == "64") {
+            wide = field == "128";
+        } else if (!parseDecimalRounding(field, format.d_rounding)) {
+            std::cout << "Unknown rounding mode: " << field << "\n";
+            return 1;
+        }
+    }
+
+    std::unordered_map<std::string, std::string> bindings;
+    for (auto& arg : bindingArgs) {
+        size_t equals = arg.find('=');
+        if (equals == std::string::npos) {
+            std::cout << "Expected name=value: " << arg << "\n";
+            return 1;
+        }
+        bindings[arg.substr(0, equals)] = arg.substr(equals + 1);
+    }
+
+    auto tokens = tokenizeExpression(text);
+    if (tokens.empty())
+        return 1;
+
+    return wide ? evaluateDecimalCommand<__int128>(tokens, format, bindings, backend)
+                : evaluateDecimalCommand<int64_t>(tokens, format, bindings, backend);
+}
+
+/*
+    Fused aggregation
+
+    SUM/MIN/MAX/COUNT of an expression are folded straight out of the block
+    scratch, so the per-row results are never written to a full-length column.
+    Each worker thread keeps its own partial aggregate over a contiguous range
+    of rows and the partials are merged once at the end.
+*/
+
+struct Aggregate {
+    int64_t  d_sum = 0;     // Wraps on overflow like the other integer operators
+    int64_t  d_min = std::numeric_limits<int64_t>::max();
+    int64_t  d_max = std::numeric_limits<int64_t>::min();
+    uint64_t d_count = 0;
+
+    void merge(const Aggregate& other) {
+        d_sum = static_cast<int64_t>(static_cast<uint64_t>(d_sum) + static_cast<uint64_t>(other.d_sum));
+        d_min = std::min(d_min, other.d_min);
+        d_max = std::max(d_max, other.d_max);
+        d_count += other.d_count;
+    }
+};
+
+inline void accumulateBlock(const int64_t* values, size_t count, Aggregate& aggregate) {
+    uint64_t sum = 0;
+    int64_t minValue = aggregate.d_min;
+    int64_t maxValue = aggregate.d_max;
+
+    for (size_t i = 0; i < count; ++i) {
+        sum += static_cast<uint64_t>(values[i]);
+        minValue = std::min(minValue, values[i]);
+        maxValue = std::max(maxValue, values[i]);
+    }
+
+    aggregate.d_sum = static_cast<int64_t>(static_cast<uint64_t>(aggregate.d_sum) + sum);
+    aggregate.d_min = minValue;
+    aggregate.d_max = maxValue;
+    aggregate.d_count += count;
+}
+
+// Aggregates either the dense rows [rowBegin, rowEnd) or, when 'selection' is given,
+// the selected rows at positions [rowBegin, rowEnd) of the selection vector.
+Aggregate aggregateRange(const CompiledExpression& program, const ColumnBatch& batch,
+                         const SelectionVector* selection, size_t rowBegin, size_t rowEnd) {
+    Aggregate aggregate;
+    std::vector<int64_t> scratch(program.d_maxStackDepth * BATCH_BLOCK_SIZE);
+    size_t blockSize = batchBlockSize(program);
+
+    for (size_t row = rowBegin; row < rowEnd; row += blockSize) {
+        size_t count = std::min(blockSize, rowEnd - row);
+        const int64_t* values = selection
+            ? runBlock(program, batch, 0, count, selection->data() + row, scratch.data())
+            : runBlock(program, batch, row, count, nullptr, scratch.data());
+
+        accumulateBlock(values, count, aggregate);
+    }
+
+    return aggregate;
+}
+
+Aggregate aggregateParallel(const CompiledExpression& program, const ColumnBatch& batch,
+                            const SelectionVector* selection, size_t rowCount, size_t threadCount) {
+    // Don't bother spawning threads for less than a few blocks per thread
+    size_t maxThreads = std::max<size_t>(1, rowCount / (4 * BATCH_BLOCK_SIZE));
+    threadCount = std::max<size_t>(1, std::min(threadCount, maxThreads));
+
+    if (threadCount == 1)
+        return aggregateRange(program, batch, selection, 0, rowCount);
+
+    // Ranges are block-aligned so no block straddles two threads
+    size_t blocks = (rowCount + BATCH_BLOCK_SIZE - 1) / BATCH_BLOCK_SIZE;
+    size_t blocksPerThread = (blocks + threadCount - 1) / threadCount;
+
+    std::vector<Aggregate> partials(threadCount);
+    std::vector<std::thread> workers;
+
+    for (size_t t = 0; t < threadCount; ++t) {
+        size_t rowBegin = std::min(rowCount, t * blocksPerThread * BATCH_BLOCK_SIZE);
+        size_t rowEnd = std::min(rowCount, rowBegin + blocksPerThread * BATCH_BLOCK_SIZE);
+
+        workers.emplace_back([&, t, rowBegin, rowEnd]() {
+            partials[t] = aggregateRange(program, batch, selection, rowBegin, rowEnd);
+        });
+    }
+
+    Aggregate result;
+    for (size_t t = 0; t < threadCount; ++t) {
+        workers[t].join();
+        result.merge(partials[t]);
+    }
+
+    return result;
+}
+
+// Computes SUM/MIN/MAX/COUNT of the expression over every row of the batch
+Aggregate aggregateBatch(const CompiledExpression& program, const ColumnBatch& batch, size_t threadCount = 1) {
+    return aggregateParallel(program, batch, nullptr, batch.d_rowCount, threadCount);
+}
+
+// Computes SUM/MIN/MAX/COUNT of the expression over the selected rows only
+Aggregate aggregateBatch(const CompiledExpression& program, const ColumnBatch& batch,
+                         const SelectionVector& selection, size_t threadCount = 1) {
+    return aggregateParallel(program, batch, &selection, selection.size(), threadCount);
+}
+
+/*
+    Zone maps
+
+    A zone map keeps the min and max of every column per block of
+    BATCH_BLOCK_SIZE rows. Evaluating a predicate over those intervals instead
+    of values bounds what it can return for any row of the block: if the bound
+    excludes zero every row is selected, if it is exactly zero none is, and only
+    the remaining blocks are evaluated row by row. The interval rules are sound
+    for the wrapping semantics: whenever a bound could overflow, or for
+    operators without a rule, the result widens to the full int64 range.
+*/
+
+struct Interval {
+    int64_t d_min = std::numeric_limits<int64_t>::min();
+    int64_t d_max = std::numeric_limits<int64_t>::max();
+
+    static Interval exactly(int64_t value) { return { value, value }; }
+    static Interval boolean(bool canBeFalse, bool canBeTrue) { return { canBeFalse ? 0 : 1, canBeTrue ? 1 : 0 }; }
+
+    bool singleton() const { return d_min == d_max; }
+    bool containsZero() const { return d_min <= 0 && d_max >= 0; }
+};
+
+// Combines every corner of the two intervals with 'fn', which reports overflow by returning false
+template <typename Fn>
+inline Interval intervalFromCorners(const Interval& lhs, const Interval& rhs, Fn fn) {
+    int64_t corners[4];
+    if (!fn(lhs.d_min, rhs.d_min, corners[0]) || !fn(lhs.d_min, rhs.d_max, corners[1]) ||
+        !fn(lhs.d_max, rhs.d_min, corners[2]) || !fn(lhs.d_max, rhs.d_max, corners[3]))
+        return {};
+
+    return { *std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4) };
+}
+
+Interval applyIntervalOperator(OpCode opcode, const Interval& lhs, const Interval& rhs) {
+    switch (opcode) {
+    case OpCode::Add:
+        return intervalFromCorners(lhs, rhs, [](int64_t a, int64_t b, int64_t& r) { return !__builtin_add_overflow(a, b, &r); });
+    case OpCode::Subtract:
+        return intervalFromCorners(lhs, rhs, [](int64_t a, int64_t b, int64_t& r) { return !__builtin_sub_overflow(a, b, &r); });
+    case OpCode::Multiply:
+        return intervalFromCorners(lhs, rhs, [](int64_t a, int64_t b, int64_t& r) { return !__builtin_mul_overflow(a, b, &r); });
+    case OpCode::Divide:
+        // Truncating division is monotonic in each operand while the divisor keeps its sign,
+        // a divisor range touching 0 or -1 hits the special cases and is left unbounded
+        if (rhs.d_min <= 0 && rhs.d_max >= -1)
+            return {};
+        return intervalFromCorners(lhs, rhs, [](int64_t a, int64_t b, int64_t& r) { r = a / b; return true; });
+    case OpCode::Less:
+        return Interval::boolean(lhs.d_max >= rhs.d_min, lhs.d_min < rhs.d_max);
+    case OpCode::LessEqual:
+        return Interval::boolean(lhs.d_max > rhs.d_min, lhs.d_min <= rhs.d_max);
+    case OpCode::Greater:
+        return Interval::boolean(lhs.d_min <= rhs.d_max, lhs.d_max > rhs.d_min);
+    case OpCode::GreaterEqual:
+        return Interval::boolean(lhs.d_min < rhs.d_max, lhs.d_max >= rhs.d_min);
+    case OpCode::Equal:
+    case OpCode::NotEqual: {
+        bool canBeEqual = lhs.d_min <= rhs.d_max && rhs.d_min <= lhs.d_max;
+        bool mustBeEqual = lhs.singleton() && rhs.singleton() && lhs.d_min == rhs.d_min;
+        return opcode == OpCode::Equal ? Interval::boolean(!mustBeEqual, canBeEqual)
+                                       : Interval::boolean(canBeEqual, !mustBeEqual);
+    }
+    case OpCode::BitwiseAnd:
+        // Predicates combined with '&' are the common case, both sides then lie in [0, 1]
+        if (lhs.singleton() && rhs.singleton())
+            return Interval::exactly(lhs.d_min & rhs.d_min);
+        if (lhs.d_min >= 0 && rhs.d_min >= 0)
+            return { 0, std::min(lhs.d_max, rhs.d_max) };
+        return {};
+    case OpCode::BitwiseOr: {
+        if (lhs.singleton() && rhs.singleton())
+            return Interval::exactly(lhs.d_min | rhs.d_min);
+        if (lhs.d_min < 0 || rhs.d_min < 0)
+            return {};
+
+        // The result has no bit above the highest bit of either operand
+        uint64_t bits = static_cast<uint64_t>(std::max(lhs.d_max, rhs.d_max));
+        for (int shift = 1; shift < 64; shift *= 2)
+            bits |= bits >> shift;
+        return { std::max(lhs.d_min, rhs.d_min), static_cast<int64_t>(bits) };
+    }
+    case OpCode::DecimalMultiply:
+    case OpCode::DecimalDivide:
+        // Their rounding depends on the format in the instruction, which is not available here
+        return {};
+    default:
+        if (lhs.singleton() && rhs.singleton())
+            return Interval::exactly(applyBinaryOperator(opcode, lhs.d_min, rhs.d_min));
+        return {};
+    }
+}
+
+Interval applyIntervalOperator(const Instruction& instruction, const Interval& value) {
+    switch (instruction.d_opcode) {
+    case OpCode::Negate:
+        if (value.d_min == std::numeric_limits<int64_t>::min())
+            return {};
+        return { -value.d_max, -value.d_min };
+    case OpCode::LogicalNot:
+        return Interval::boolean(value.d_min != 0 || value.d_max != 0, value.containsZero());
+    case OpCode::BitwiseNot:
+        return { ~value.d_max, ~value.d_min };
+    case OpCode::PowerConstant:
+        if (value.singleton())
+            return Interval::exactly(powerConstant(value.d_min, instruction.d_operand));
+        return {};
+    default:
+        return {};
+    }
+}
+
+// 'columns' holds one interval per variable slot
+Interval evaluateInterval(const CompiledExpression& program, const Interval* columns, const int64_t* literals = nullptr) {
+    std::vector<Interval> stack;
+    stack.reserve(program.d_maxStackDepth);
+
+    for (auto& instruction : program.d_code) {
+        switch (instruction.d_opcode) {
+        case OpCode::PushConstant:
+            stack.push_back(Interval::exactly(instruction.d_operand));
+            break;
+        case OpCode::PushVariable:
+            stack.push_back(columns[instruction.d_operand]);
+            break;
+        case OpCode::PushLiteral:
+            stack.push_back(Interval::exactly(literals[instruction.d_operand]));
+            break;
+        default:
+            if (operandCount(instruction.d_opcode) == 1) {
+                stack.back() = applyIntervalOperator(instruction, stack.back());
+            } else {
+                Interval rhs = stack.back();
+                stack.pop_back();
+                stack.back() = applyIntervalOperator(instruction.d_opcode, stack.back(), rhs);
+            }
+            break;
+        }
+    }
+
+    return stack.back();
+}
+
+struct ZoneMap {
+    std::vector<std::vector<Interval>> d_columns;  // Per column, per block of BATCH_BLOCK_SIZE rows
+    size_t                             d_rowCount = 0;
+
+    // Records min/max of every column of 'batch', indexed like its columns
+    static ZoneMap build(const ColumnBatch& batch) {
+        ZoneMap zones;
+        zones.d_rowCount = batch.d_rowCount;
+        size_t blocks = (batch.d_rowCount + BATCH_BLOCK_SIZE - 1) / BATCH_BLOCK_SIZE;
+
+        for (auto* column : batch.d_columns) {
+            std::vector<Interval> intervals(blocks);
+            for (size_t block = 0; block < blocks; ++block) {
+                size_t begin = block * BATCH_BLOCK_SIZE;
+                size_t end = std::min(batch.d_rowCount, begin + BATCH_BLOCK_SIZE);
+                auto bounds = std::minmax_element(column + begin, column + end);
+                intervals[block] = { *bounds.first, *bounds.second };
+            }
+            zones.d_columns.push_back(std::move(intervals));
+        }
+
+        return zones;
+    }
+};
+
+struct ZoneMapStats {
+    size_t d_allTrueBlocks = 0;
+    size_t d_allFalseBlocks = 0;
+    size_t d_mixedBlocks = 0;
+};
+
+// Returns the indices of all rows for which the predicate is true, resolving blocks
+// from the zone map of 'batch' where it decides them and evaluating the rest
+SelectionVector filterBatch(const CompiledExpression& program, const ColumnBatch& batch,
+                            const ZoneMap& zones, ZoneMapStats* stats = nullptr) {
+    // A zone map built for another batch would index past its blocks or columns
+    if (zones.d_rowCount != batch.d_rowCount || zones.d_columns.size() != batch.d_columns.size()) {
+        std::cout << "Zone map does not match the batch, filtering without it\n";
+        return filterBatch(program, batch);
+    }
+
+    SelectionVector selection;
+    std::vector<int64_t> scratch(program.d_maxStackDepth * BATCH_BLOCK_SIZE);
+    std::vector<Interval> intervals(zones.d_columns.size());
+    int64_t values[BATCH_BLOCK_SIZE];
+    size_t blockSize = batchBlockSize(program);
+    ZoneMapStats counts;
+
+    for (size_t row = 0; row < batch.d_rowCount; row += BATCH_BLOCK_SIZE) {
+        size_t block = row / BATCH_BLOCK_SIZE;
+        size_t rowEnd = std::min(batch.d_rowCount, row + BATCH_BLOCK_SIZE);
+
+        for (size_t column = 0; column < intervals.size(); ++column)
+            intervals[column] = zones.d_columns[column][block];
+        Interval result = evaluateInterval(program, intervals.data(), batch.d_literals);
+
+        if (!result.containsZero()) {
+            ++counts.d_allTrueBlocks;
+            for (size_t i = row; i < rowEnd; ++i)
+                selection.push_back(static_cast<uint32_t>(i));
+            continue;
+        }
+
+        if (result.d_min == 0 && result.d_max == 0) {
+            ++counts.d_allFalseBlocks;
+            continue;
+        }
+
+        ++counts.d_mixedBlocks;
+        for (size_t i = row; i < rowEnd; i += blockSize) {
+            size_t count = std::min(blockSize, rowEnd - i);
+            evaluateBlock(program, batch, i, count, nullptr, scratch.data(), values);
+            appendSelectedRows(values, nullptr, static_cast<uint32_t>(i), count, selection);
+        }
+    }
+
+    if (stats)
+        *stats = counts;
+    return selection;
+}
+
+/*
+    Huge pages
+
+    Buffers of at least one huge page (column vectors, batch results) can be
+    backed by huge pages to cut TLB misses on multi-gigabyte batches. Explicit
+    mode asks for MAP_HUGETLB pages from the reserved pool, transparent mode asks
+    the kernel to promote the mapping with madvise(MADV_HUGEPAGE), and either
+    falls back to normal pages when the kernel refuses. Large buffers are always
+    mapped directly, whatever the mode, so they can be freed without knowing
+    how they were allocated. The statistics count the bytes currently mapped in
+    each way, and the peak of each, so a streamed batch that maps and unmaps
+    buffers block by block reports what was backed at once, not the total.
+*/
+
+constexpr size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+enum class HugePageMode {
+    Off,
+    Transparent,
+    Explicit
+};
+
+enum HugePageBacking {
+    ExplicitBacking,    // Reserved hugetlb pages, always huge
+    AdvisedBacking,     // madvise(MADV_HUGEPAGE) accepted, promotion is up to the kernel
+    FallbackBacking,    // Huge pages requested but unavailable
+    NormalBacking,      // Huge pages not requested
+    HugePageBackingCount
+};
+
+class HugePageStats {
+public:
+    void mapped(void* memory, size_t bytes, HugePageBacking backing) {
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            d_backings[memory] = backing;
+        }
+
+        uint64_t current = d_bytes[backing].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        uint64_t peak = d_peakBytes[backing].load(std::memory_order_relaxed);
+        while (peak < current && !d_peakBytes[backing].compare_exchange_weak(peak, current, std::memory_order_relaxed)) {}
+    }
+
+    void unmapped(void* memory, size_t bytes) {
+        HugePageBacking backing;
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            auto it = d_backings.find(memory);
+            if (it == d_backings.end())
+                return;
+
+            backing = it->second;
+            d_backings.erase(it);
+        }
+
+        d_bytes[backing].fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    uint64_t bytes(HugePageBacking backing) const { return d_bytes[backing].load(std::memory_order_relaxed); }
+    uint64_t peakBytes(HugePageBacking backing) const { return d_peakBytes[backing].load(std::memory_order_relaxed); }
+
+private:
+    std::mutex                                  d_mutex;
+    std::unordered_map<void*, HugePageBacking>  d_backings;     // Large buffers are few, one entry per mapping
+    std::atomic<uint64_t>                       d_bytes[HugePageBackingCount] = {};
+    std::atomic<uint64_t>                       d_peakBytes[HugePageBackingCount] = {};
+};
+
+std::atomic<HugePageMode>& hugePageMode() {
+    static std::atomic<HugePageMode> mode{ HugePageMode::Off };
+    return mode;
+}
+
+HugePageStats& hugePageStats() {
+    static HugePageStats stats;
+    return stats;
+}
+
+#ifdef __linux__
+
+// Anonymous memory of this process the kernel actually backs with transparent huge pages
+uint64_t transparentHugePageBytes() {
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    std::string line;
+    while (std::getline(rollup, line)) {
+        if (line.compare(0, 14, "AnonHugePages:") == 0)
+            return std::strtoull(line.c_str() + 14, nullptr, 10) * 1024;
+    }
+
+    return 0;
+}
+
+void* allocateLargeBuffer(size_t bytes) {
+    bytes = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    HugePageMode mode = hugePageMode().load(std::memory_order_relaxed);
+
+    if (mode == HugePageMode::Explicit) {
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            hugePageStats().mapped(memory, bytes, ExplicitBacking);
+            return memory;
+        }
+    }
+
+    void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::bad_alloc();
+
+    HugePageBacking backing = NormalBacking;
+    if (mode != HugePageMode::Off)
+        backing = madvise(memory, bytes, MADV_HUGEPAGE) == 0 ? AdvisedBacking : FallbackBacking;
+    hugePageStats().mapped(memory, bytes, backing);
+
+    return memory;
+}
+
+void freeLargeBuffer(void* memory, size_t bytes) {
+    bytes = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    hugePageStats().unmapped(memory, bytes);
+    munmap(memory, bytes);
+}
+
+#endif // __linux__
+
+void printHugePageStats() {
+    static const char* names[] = { "explicit", "advised", "fallback" };
+    auto& stats = hugePageStats();
+
+    std::cout << "Huge pages:";
+    for (int backing = ExplicitBacking; backing <= FallbackBacking; ++backing) {
+        auto kind = static_cast<HugePageBacking>(backing);
+        std::cout << (backing == ExplicitBacking ? " " : ", ") << stats.bytes(kind) / (1024 * 1024) << " MB "
+                  << names[backing] << " (peak " << stats.peakBytes(kind) / (1024 * 1024) << " MB)";
+    }
+#ifdef __linux__
+    std::cout << ", " << transparentHugePageBytes() / (1024 * 1024) << " MB transparent in use";
+#endif
+    std::cout << "\n";
+}
+
+/*
+    Column input
+
+    Variable values are read from CSV (a header row of variable names followed
+    by integer rows) or from a raw little-endian column file, one block of rows
+    at a time, so the whole dataset never has to fit in memory.
+
+    Column file layout:
+        char[8]     magic "SYCOLS01"
+        uint64      row count
+        uint32      column count
+        per column: uint32 name length, name bytes
+        per column: row count x int64 values (column-major)
+*/
+
+constexpr size_t COLUMN_ALIGNMENT = 64;
+
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        size_t bytes = (count * sizeof(T) + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+#ifdef __linux__
+        if (bytes >= HUGE_PAGE_BYTES)
+            return static_cast<T*>(allocateLargeBuffer(bytes));
+#endif
+
+        void* memory = std::aligned_alloc(COLUMN_ALIGNMENT, bytes);
+        if (!memory)
+            throw std::bad_alloc();
+
+        return static_cast<T*>(memory);
+    }
+
+    void deallocate(T* memory, size_t count) {
+#ifdef __linux__
+        size_t bytes = (count * sizeof(T) + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+        if (bytes >= HUGE_PAGE_BYTES)
+            return freeLargeBuffer(memory, bytes);
+#endif
+        (void)count;
+        std::free(memory);
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+using ColumnVector = std::vector<int64_t, AlignedAllocator<int64_t>>;
+
+struct ColumnBlock {
+    std::vector<ColumnVector> d_columns;
+    size_t                    d_rowCount = 0;
+};
+
+class ColumnReader {
+public:
+    virtual ~ColumnReader() = default;
+
+    virtual const std::vector<std::string>& columnNames() const = 0;
+
+    // Replaces the contents of 'block' with the next rows, returns false at the end of input
+    // or on an error, which failed() then tells apart
+    virtual bool readBlock(ColumnBlock& block) = 0;
+
+    virtual bool failed() const = 0;
+};
+
+constexpr size_t CSV_CHUNK_BYTES = 8 * 1024 * 1024;
+
+class CsvColumnReader : public ColumnReader {
+public:
+    CsvColumnReader(const std::string& path, size_t threadCount)
+        : d_file(path, std::ios::binary), d_threadCount(std::max<size_t>(1, threadCount)) {
+        std::string header;
+        if (!std::getline(d_file, header)) {
+            std::cout << "Failed to read CSV header from " << path << "\n";
+            d_failed = true;
+            return;
+        }
+
+        if (!header.empty() && header.back() == '\r')
+            header.pop_back();
+
+        size_t start = 0;
+        while (start <= header.size()) {
+            size_t end = header.find(',', start);
+            if (end == std::string::npos)
+                end = header.size();
+
+            d_names.push_back(trimField(header, start, end));
+            start = end + 1;
+        }
+    }
+
+    virtual const std::vector<std::string>& columnNames() const override { return d_names; }
+
+    virtual bool failed() const override { return d_failed; }
+
+    virtual bool readBlock(ColumnBlock& block) override {
+        block.d_columns.assign(d_names.size(), ColumnVector());
+        block.d_rowCount = 0;
+
+        while (!d_failed && block.d_rowCount == 0) {
+            if (d_file.eof() && d_pending.empty())
+                return false;
+
+            // Append the next chunk to the partial line left over from the previous one
+            size_t previous = d_pending.size();
+            d_pending.resize(previous + CSV_CHUNK_BYTES);
+            d_file.read(&d_pending[previous], CSV_CHUNK_BYTES);
+            d_pending.resize(previous + static_cast<size_t>(d_file.gcount()));
+
+            size_t end = d_file.eof() ? d_pending.size() : d_pending.rfind('\n') + 1;
+            if (end == 0)
+                continue; // No complete line yet, keep reading
+
+            parseLines(d_pending.data(), d_pending.data() + end, block);
+            d_pending.erase(0, end);
+        }
+
+        return !d_failed && block.d_rowCount > 0;
+    }
+
+private:
+    static std::string trimField(const std::string& line, size_t start, size_t end) {
+        while (start < end && std::isspace(static_cast<unsigned char>(line[start])))
+            ++start;
+        while (end > start && std::isspace(static_cast<unsigned char>(line[end - 1])))
+            --end;
+
+        return line.substr(start, end - start);
+    }
+
+    // Parses whole lines in [begin, end) into per-column vectors, returns false on a malformed row
+    bool parseRange(const char* begin, const char* end, std::vector<ColumnVector>& columns) const {
+        columns.assign(d_names.size(), ColumnVector());
+        const char* cursor = begin;
+
+        while (cursor < end) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+            if (!lineEnd)
+                lineEnd = end;
+
+            const char* field = cursor;
+            cursor = lineEnd + 1;
+
+            // Skip blank lines
+            if (field == lineEnd || (field + 1 == lineEnd && *field == '\r'))
+                continue;
+
+            for (size_t column = 0; column < d_names.size(); ++column) {
+                while (field < lineEnd && (*field == ' ' || *field == '\t'))
+                    ++field;
+
+                int64_t value = 0;
+                auto result = std::from_chars(field, lineEnd, value);
+                if (result.ec != std::errc())
+                    return false;
+
+                field = result.ptr;
+                while (field < lineEnd && (*field == ' ' || *field == '\t' || *field == '\r'))
+                    ++field;
+
+                bool last = (column + 1 == d_names.size());
+                if (last ? field != lineEnd : (field == lineEnd || *field != ','))
+                    return false;
+
+                ++field;
+                columns[column].push_back(value);
+            }
+        }
+
+        return true;
+    }
+
+    // Splits the lines among the worker threads at newline boundaries and
+    // appends the parsed rows to the block in their original order.
+    void parseLines(const char* begin, const char* end, ColumnBlock& block) {
+        size_t threadCount = std::min(d_threadCount, std::max<size_t>(1, (end - begin) / (256 * 1024)));
+        std::vector<const char*> splits = { begin };
+
+        for (size_t t = 1; t < threadCount; ++t) {
+            const char* split = std::max(splits.back(), begin + (end - begin) * t / threadCount);
+            const char* newline = static_cast<const char*>(std::memchr(split, '\n', end - split));
+            splits.push_back(newline ? newline + 1 : end);
+        }
+        splits.push_back(end);
+
+        std::vector<std::vector<ColumnVector>> parts(threadCount);
+        std::vector<char> succeeded(threadCount, 0);
+        std::vector<std::thread> workers;
+
+        for (size_t t = 1; t < threadCount; ++t) {
+            workers.emplace_back([&, t]() {
+                succeeded[t] = parseRange(splits[t], splits[t + 1], parts[t]);
+            });
+        }
+        succeeded[0] = parseRange(splits[0], splits[1], parts[0]);
+
+        for (auto& worker : workers)
+            worker.join();
+
+        for (size_t t = 0; t < threadCount; ++t) {
+            if (!succeeded[t]) {
+                std::cout << "Malformed CSV row error!\n";
+                d_failed = true;
+                return;
+            }
+
+            for (size_t column = 0; column < d_names.size(); ++column)
+                block.d_columns[column].insert(block.d_columns[column].end(), parts[t][column].begin(), parts[t][column].end());
+        }
+
+        block.d_rowCount = d_names.empty() ? 0 : block.d_columns[0].size();
+    }
+
+    std::ifstream               d_file;
+    std::vector<std::string>    d_names;
+    std::string                 d_pending;
+    size_t                      d_threadCount;
+    bool                        d_failed = false;
+};
+
+constexpr char COLUMN_FILE_MAGIC[8] = { 'S', 'Y', 'C', 'O', 'L', 'S', '0', '1' };
+constexpr size_t COLUMN_FILE_BLOCK_ROWS = 64 * 1024;
+constexpr uint32_t COLUMN_FILE_MAX_NAME_LENGTH = 4096;
+
+inline uint64_t fromLittleEndian(uint64_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(value);
+#else
+    return value;
+#endif
+}
+
+inline uint8_t fromLittleEndian(uint8_t value) {
+    return value;
+}
+
+inline uint32_t fromLittleEndian(uint32_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(value);
+#else
+    return value;
+#endif
+}
+
+// The header is validated against the file size before anything is allocated for it
+class BinaryColumnReader : public ColumnReader {
+public:
+    BinaryColumnReader(const std::string& path) : d_file(path, std::ios::binary) {
+        char magic[8] = {};
+        uint32_t columnCount = 0;
+
+        d_file.seekg(0, std::ios::end);
+        uint64_t fileSize = static_cast<uint64_t>(std::max<std::streamoff>(0, d_file.tellg()));
+        d_file.seekg(0);
+
+        auto invalid = [&]() {
+            std::cout << "Invalid column file: " << path << "\n";
+            d_failed = true;
+        };
+
+        d_file.read(magic, sizeof(magic));
+        d_file.read(reinterpret_cast<char*>(&d_rowCount), sizeof(d_rowCount));
+        d_file.read(reinterpret_cast<char*>(&columnCount), sizeof(columnCount));
+        d_rowCount = fromLittleEndian(d_rowCount);
+        columnCount = fromLittleEndian(columnCount);
+
+        // Every column name takes at least its 4-byte length
+        uint64_t headerSize = sizeof(magic) + sizeof(d_rowCount) + sizeof(columnCount);
+        if (!d_file || std::memcmp(magic, COLUMN_FILE_MAGIC, sizeof(magic)) != 0 ||
+            columnCount > (fileSize - headerSize) / sizeof(uint32_t)) {
+            invalid();
+            return;
+        }
+
+        uint64_t offset = headerSize;
+        for (uint32_t column = 0; column < columnCount; ++column) {
+            uint32_t length = 0;
+            d_file.read(reinterpret_cast<char*>(&length), sizeof(length));
+            length = fromLittleEndian(length);
+            offset += sizeof(length);
+
+            if (!d_file || length > COLUMN_FILE_MAX_NAME_LENGTH || length > fileSize - offset) {
+                invalid();
+                return;
+            }
+
+            std::string name(length, '\0');
+            d_file.read(&name[0], name.size());
+            offset += length;
+            d_names.push_back(name);
+        }
+
+        d_dataOffset = offset;
+        if (!d_file || (columnCount != 0 && d_rowCount > (fileSize - offset) / sizeof(int64_t) / columnCount))
+            invalid();
+    }
+
+    virtual const std::vector<std::string>& columnNames() const override { return d_names; }
+
+    virtual bool failed() const override { return d_failed; }
+
+    virtual bool readBlock(ColumnBlock& block) override {
+        block.d_columns.resize(d_names.size());
+        block.d_rowCount = 0;
+
+        if (d_failed || d_nextRow >= d_rowCount)
+            return false;
+
+        size_t count = static_cast<size_t>(std::min<uint64_t>(COLUMN_FILE_BLOCK_ROWS, d_rowCount - d_nextRow));
+
+        for (size_t column = 0; column < d_names.size(); ++column) {
+            auto& values = block.d_columns[column];
+            values.resize(count);
+
+            d_file.seekg(d_dataOffset + (column * d_rowCount + d_nextRow) * sizeof(int64_t));
+            d_file.read(reinterpret_cast<char*>(values.data()), count * sizeof(int64_t));
+            if (!d_file) {
+                std::cout << "Truncated column file error!\n";
+                d_failed = true;
+                return false;
+            }
+
+            for (auto& value : values)
+                value = static_cast<int64_t>(fromLittleEndian(static_cast<uint64_t>(value)));
+        }
+
+        d_nextRow += count;
+        block.d_rowCount = count;
+        return true;
+    }
+
+private:
+    std::ifstream               d_file;
+    std::vector<std::string>    d_names;
+    uint64_t                    d_rowCount = 0;
+    uint64_t                    d_nextRow = 0;
+    uint64_t                    d_dataOffset = 0;
+    bool                        d_failed = false;
+};
+
+// Writes equally sized columns in the column file layout, returns false on I/O failure
+bool writeColumnFile(const std::string& path, const std::vector<std::string>& names,
+                     const std::vector<const int64_t*>& columns, uint64_t rowCount) {
+    std::ofstream file(path, std::ios::binary);
+    uint64_t rows = fromLittleEndian(rowCount);
+    uint32_t columnCount = fromLittleEndian(static_cast<uint32_t>(names.size()));
+
+    file.write(COLUMN_FILE_MAGIC, sizeof(COLUMN_FILE_MAGIC));
+    file.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+    file.write(reinterpret_cast<const char*>(&columnCount), sizeof(columnCount));
+
+    for (auto& name : names) {
+        uint32_t length = fromLittleEndian(static_cast<uint32_t>(name.size()));
+        file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        file.write(name.data(), name.size());
+    }
+
+    for (auto column : columns) {
+        for (uint64_t row = 0; row < rowCount; ++row) {
+            uint64_t value = fromLittleEndian(static_cast<uint64_t>(column[row]));
+            file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+    }
+
+    return static_cast<bool>(file);
+}
+
+// Picks the reader from the file contents: column files start with the magic, anything else is CSV
+std::unique_ptr<ColumnReader> openColumnFile(const std::string& path, size_t threadCount) {
+    std::ifstream probe(path, std::ios::binary);
+    if (!probe) {
+        std::cout << "Failed to open " << path << "\n";
+        return nullptr;
+    }
+
+    char magic[8] = {};
+    probe.read(magic, sizeof(magic));
+    if (probe.gcount() == sizeof(magic) && std::memcmp(magic, COLUMN_FILE_MAGIC, sizeof(magic)) == 0)
+        return std::make_unique<BinaryColumnReader>(path);
+
+    return std::make_unique<CsvColumnReader>(path, threadCount);
+}
+
+// Evaluates 'expression' for every row of 'inputPath' and writes one result per line to 'outputPath'
+int runBatchCommand(const std::string& expression, const std::string& inputPath,
+                    const std::string& outputPath, size_t threadCount, ParserBackend backend) {
+    auto reader = openColumnFile(inputPath, threadCount);
+    if (!reader || reader->failed())
+        return 1;
+
+    // The input columns are the variable schema, so their symbol IDs are normally the column indices
+    symbolTable().setSchema(reader->columnNames());
+
+    auto tokens = tokenizeExpression(expression);
+    if (tokens.empty())
+        return 1;
+
+    auto program = compileExpression(parseTokens(tokens, backend));
+    if (!program.valid())
+        return 1;
+
+    // Map every variable slot of the program to a column of the input
+    std::vector<size_t> columnForSlot;
+    auto& names = reader->columnNames();
+    for (size_t slot = 0; slot < program.d_symbols.size(); ++slot) {
+        size_t column = program.d_symbols[slot];
+        if (column >= names.size() || names[column] != program.d_variables[slot])
+            column = static_cast<size_t>(std::find(names.begin(), names.end(), program.d_variables[slot]) - names.begin());
+
+        if (column >= names.size()) {
+            std::cout << "Unbound variable: " << program.d_variables[slot] << "\n";
+            return 1;
+        }
+
+        columnForSlot.push_back(column);
+    }
+
+    std::ofstream output(outputPath, std::ios::binary);
+    if (!output) {
+        std::cout << "Failed to open " << outputPath << "\n";
+        return 1;
+    }
+
+    ColumnBlock block;
+    ColumnBatch batch;
+    ColumnVector results;
+    std::string text;
+
+    while (reader->readBlock(block)) {
+        batch.d_columns.clear();
+        for (auto column : columnForSlot)
+            batch.d_columns.push_back(block.d_columns[column].data());
+        batch.d_rowCount = block.d_rowCount;
+
+        results.resize(block.d_rowCount);
+        evaluateBatch(program, batch, results.data());
+
+        text.clear();
+        char number[24];
+        for (auto value : results) {
+            auto end = std::to_chars(number, number + sizeof(number), value).ptr;
+            text.append(number, end);
+            text.push_back('\n');
+        }
+        output.write(text.data(), text.size());
+    }
+
+    // A malformed or truncated input leaves a partial output, which must not look like success
+    if (reader->failed())
+        return 1;
+
+    return output ? 0 : 1;
+}
+
+/*
+    Shape-grouped evaluation
+
+    Evaluates many lifted expressions at once. Expressions sharing a shape are
+    grouped and run as one batch in which every row is a different expression:
+    the shape's literals become extra columns holding each expression's own
+    values, so a group of tiny one-off programs turns into a single pass of the
+    vectorized batch kernels.
+*/
+
+constexpr size_t SHAPE_GROUP_MIN_SIZE = 16;
+
+// Copy of a lifted shape reading literal k from column (variable count + k) instead
+CompiledExpression literalsAsColumns(const CompiledExpression& shape) {
+    CompiledExpression program = shape;
+    size_t variableCount = shape.d_variables.size();
+
+    for (auto& instruction : program.d_code) {
+        if (instruction.d_opcode == OpCode::PushLiteral) {
+            instruction.d_opcode = OpCode::PushVariable;
+            instruction.d_operand += static_cast<int64_t>(variableCount);
+        }
+    }
+
+    for (size_t literal = 0; literal < shape.d_literalCount; ++literal) {
+        program.d_variables.push_back("#" + std::to_string(literal));
+        program.d_symbols.push_back(std::numeric_limits<uint32_t>::max());
+    }
+    program.d_literalCount = 0;
+
+    return program;
+}
+
+// Expressions of one ShapeCache grouped by shape, with each group's literals already
+// transposed into columns, so repeated evaluations only bind the variables. Everything
+// evaluate needs is copied, so the expressions need not outlive the groups.
+class ShapeGroups {
+public:
+    // Invalid expressions, as ShapeCache::compile returns for malformed input, evaluate as 0
+    explicit ShapeGroups(const std::vector<LiftedExpression>& expressions) {
+        for (auto& expression : expressions) {
+            if (!expression.valid())
+                continue;
+
+            if (expression.d_shapeId >= d_groups.size())
+                d_groups.resize(expression.d_shapeId + 1);
+            d_groups[expression.d_shapeId].d_shape = expression.d_shape;
+            ++d_groups[expression.d_shapeId].d_rowCount;
+        }
+
+        size_t groupedRows = 0;
+        for (auto& group : d_groups) {
+            if (group.d_rowCount < SHAPE_GROUP_MIN_SIZE)
+                continue;
+
+            group.d_program = literalsAsColumns(*group.d_shape);
+            group.d_columns.assign(group.d_program.d_variables.size(), ColumnVector(group.d_rowCount));
+            group.d_resultBegin = groupedRows;
+            groupedRows += group.d_rowCount;
+            d_hasVariables |= !group.d_shape->d_variables.empty();
+        }
+        d_results.resize(groupedRows);
+
+        // Filled in input order, so each expression's literals are read once and sequentially
+        std::vector<uint32_t> filled(d_groups.size(), 0);
+
+        for (size_t i = 0; i < expressions.size(); ++i) {
+            if (!expressions[i].valid()) {
+                d_invalid.push_back(static_cast<uint32_t>(i));
+                continue;
+            }
+
+            uint32_t shapeId = expressions[i].d_shapeId;
+            auto& group = d_groups[shapeId];
+            if (group.d_rowCount < SHAPE_GROUP_MIN_SIZE) {
+                d_ungrouped.emplace_back(static_cast<uint32_t>(i), expressions[i]);
+                continue;
+            }
+
+            uint32_t row = filled[shapeId]++;
+            d_grouped.push_back({ static_cast<uint32_t>(i), shapeId, row });
+
+            size_t variableCount = group.d_shape->d_variables.size();
+            for (size_t literal = 0; literal < expressions[i].d_literals.size(); ++literal)
+                group.d_columns[variableCount + literal][row] = expressions[i].d_literals[literal];
+        }
+    }
+
+    // 'variables' holds one slot-ordered value array per expression, or is empty when no
+    // expression has variables. 'results' receives one value per expression.
+    void evaluate(const std::vector<const int64_t*>& variables, int64_t* results) {
+        if (d_hasVariables) {
+            for (auto& member : d_grouped) {
+                auto& group = d_groups[member.d_group];
+                for (size_t slot = 0; slot < group.d_shape->d_variables.size(); ++slot)
+                    group.d_columns[slot][member.d_row] = variables[member.d_expression][slot];
+            }
+        }
+
+        for (auto& group : d_groups) {
+            if (group.d_rowCount < SHAPE_GROUP_MIN_SIZE)
+                continue;
+
+            ColumnBatch batch;
+            batch.d_rowCount = group.d_rowCount;
+            for (auto& column : group.d_columns)
+                batch.d_columns.push_back(column.data());
+
+            evaluateBatch(group.d_program, batch, d_results.data() + group.d_resultBegin);
+        }
+
+        for (auto& member : d_grouped)
+            results[member.d_expression] = d_results[d_groups[member.d_group].d_resultBegin + member.d_row];
+
+        // Groups too small to pay for the transposition are evaluated one by one
+        for (auto& [i, expression] : d_ungrouped)
+            results[i] = evaluateLiftedExpression(expression, variables.empty() ? nullptr : variables[i]);
+
+        for (uint32_t i : d_invalid)
+            results[i] = 0;
+    }
+
+private:
+    struct Group {
+        std::shared_ptr<const CompiledExpression>   d_shape;
+        CompiledExpression                          d_program;      // The shape with literals read from columns
+        size_t                                      d_rowCount = 0;
+        size_t                                      d_resultBegin = 0;
+        std::vector<ColumnVector>                   d_columns;      // Variable slots, then literals, one row per member
+    };
+
+    struct Member {
+        uint32_t    d_expression;
+        uint32_t    d_group;
+        uint32_t    d_row;      // Within the group's columns and results
+    };
+
+    std::vector<Group>                                  d_groups;
+    std::vector<Member>                                 d_grouped;
+    std::vector<std::pair<uint32_t, LiftedExpression>>  d_ungrouped;
+    std::vector<uint32_t>                               d_invalid;
+    ColumnVector                                        d_results;
+    bool                                                d_hasVariables = false;
+};
+
+// One-off form of ShapeGroups::evaluate
+void evaluateLiftedExpressions(const std::vector<LiftedExpression>& expressions,
+                               const std::vector<const int64_t*>& variables, int64_t* results) {
+    ShapeGroups(expressions).evaluate(variables, results);
+}
+
+/*
+    NUMA-aware sharding
+
+    On multi-socket hosts a batch is split into one row shard per NUMA node.
+    Each shard's input and output columns are written first by a thread pinned
+    to that node, so the kernel's first-touch policy places them in node-local
+    memory, and every node evaluates its own replica of the compiled program
+    with workers pinned to its CPUs. The topology comes from sysfs, so no NUMA
+    library is needed; hosts without it are treated as a single node.
+*/
+
+#ifdef __linux__
+
+struct NumaNode {
+    int                 d_id = 0;
+    std::vector<int>    d_cpus;
+};
+
+// Parses a sysfs CPU or node list such as "0-3,8-11"
+std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    const char* position = text.data();
+    const char* end = text.data() + text.size();
+
+    while (position < end) {
+        int first = 0, last = 0;
+        auto parsed = std::from_chars(position, end, first);
+        if (parsed.ec != std::errc())
+            break;
+
+        last = first;
+        position = parsed.ptr;
+        if (position < end && *position == '-') {
+            parsed = std::from_chars(position + 1, end, last);
+            if (parsed.ec != std::errc())
+                break;
+            position = parsed.ptr;
+        }
+
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+
+        while (position < end && (*position == ',' || std::isspace(static_cast<unsigned char>(*position))))
+            ++position;
+    }
+
+    return cpus;
+}
+
+std::vector<NumaNode> numaTopology() {
+    std::vector<NumaNode> nodes;
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string text;
+    std::getline(online, text);
+
+    for (int id : parseCpuList(text)) {
+        std::ifstream cpuList("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+        std::string cpus;
+        std::getline(cpuList, cpus);
+
+        NumaNode node;
+        node.d_id = id;
+        node.d_cpus = parseCpuList(cpus);
+        if (!node.d_cpus.empty())
+            nodes.push_back(std::move(node));
+    }
+
+    if (nodes.empty()) {
+        NumaNode node;
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+            node.d_cpus.push_back(static_cast<int>(cpu));
+        nodes.push_back(std::move(node));
+    }
+
+    return nodes;
+}
+
+bool pinCurrentThread(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Sets the calling thread's page placement policy for memory it touches from now on
+void setInterleavedPlacement(bool interleaved, const std::vector<NumaNode>& nodes) {
+    unsigned long mask[16] = {};
+    for (auto& node : nodes) {
+        if (node.d_id < static_cast<int>(sizeof(mask) * 8))
+            mask[node.d_id / 64] |= 1ul << (node.d_id % 64);
+    }
+
+    if (interleaved)
+        syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, mask, sizeof(mask) * 8);
+    else
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+}
+
+enum class NumaPlacement {
+    Local,          // Each shard lives on the node that evaluates it
+    Interleaved     // Pages are spread round-robin over all nodes
+};
+
+class NumaShardedBatch {
+public:
+    struct Shard {
+        NumaNode                    d_node;
+        size_t                      d_rowBegin = 0;
+        size_t                      d_rowCount = 0;
+        std::vector<ColumnVector>   d_columns;
+        ColumnVector                d_results;
+        CompiledExpression          d_program;  // Node-local replica
+    };
+
+    // Copies the rows of 'batch' into one shard per node
+    NumaShardedBatch(const ColumnBatch& batch, NumaPlacement placement)
+        : d_rowCount(batch.d_rowCount) {
+        auto nodes = numaTopology();
+
+        // Shards are block-aligned so no block straddles two nodes
+        size_t blocks = (batch.d_rowCount + BATCH_BLOCK_SIZE - 1) / BATCH_BLOCK_SIZE;
+        size_t blocksPerNode = (blocks + nodes.size() - 1) / nodes.size();
+
+        for (auto& node : nodes) {
+            Shard shard;
+            shard.d_node = node;
+            shard.d_rowBegin = std::min(batch.d_rowCount, d_shards.size() * blocksPerNode * BATCH_BLOCK_SIZE);
+            shard.d_rowCount = std::min(batch.d_rowCount - shard.d_rowBegin, blocksPerNode * BATCH_BLOCK_SIZE);
+            d_shards.push_back(std::move(shard));
+        }
+
+        forEachNode([&](Shard& shard) {
+            setInterleavedPlacement(placement == NumaPlacement::Interleaved, nodes);
+
+            for (auto* column : batch.d_columns)
+                shard.d_columns.emplace_back(column + shard.d_rowBegin, column + shard.d_rowBegin + shard.d_rowCount);
+            shard.d_results.assign(shard.d_rowCount, 0);
+
+            setInterleavedPlacement(false, nodes);
+        });
+    }
+
+    // Evaluates every shard on its own node with 'threadsPerNode' pinned workers
+    // The shards carry no literal array, so 'program' must not have lifted literals
+    void evaluate(const CompiledExpression& program, size_t threadsPerNode) {
+        assert(program.d_literalCount == 0 && "lifted program run without its literals");
+        forEachNode([&](Shard& shard) {
+            shard.d_program = program;
+
+            size_t threads = std::max<size_t>(1, std::min(threadsPerNode, shard.d_node.d_cpus.size()));
+            size_t blocks = (shard.d_rowCount + BATCH_BLOCK_SIZE - 1) / BATCH_BLOCK_SIZE;
+            size_t blocksPerThread = (blocks + threads - 1) / threads;
+
+            auto evaluateRange = [&shard](size_t rowBegin, size_t rowEnd) {
+                ColumnBatch range;
+                for (auto& column : shard.d_columns)
+                    range.d_columns.push_back(column.data() + rowBegin);
+                range.d_rowCount = rowEnd - rowBegin;
+                evaluateBatch(shard.d_program, range, shard.d_results.data() + rowBegin);
+            };
+
+            std::vector<std::thread> workers;
+            for (size_t t = 1; t < threads; ++t) {
+                size_t rowBegin = std::min(shard.d_rowCount, t * blocksPerThread * BATCH_BLOCK_SIZE);
+                size_t rowEnd = std::min(shard.d_rowCount, rowBegin + blocksPerThread * BATCH_BLOCK_SIZE);
+                workers.emplace_back([&, rowBegin, rowEnd]() {
+                    pinCurrentThread(shard.d_node.d_cpus);
+                    evaluateRange(rowBegin, rowEnd);
+                });
+            }
+
+            evaluateRange(0, std::min(shard.d_rowCount, blocksPerThread * BATCH_BLOCK_SIZE));
+            for (auto& worker : workers)
+                worker.join();
+        });
+    }
+
+    void copyResults(int64_t* results) const {
+        for (auto& shard : d_shards)
+            std::copy(shard.d_results.begin(), shard.d_results.end(), results + shard.d_rowBegin);
+    }
+
+    const std::vector<Shard>& shards() const { return d_shards; }
+    size_t rowCount() const { return d_rowCount; }
+
+private:
+    // Runs 'fn' for every shard on a thread pinned to the shard's node
+    template <typename Fn>
+    void forEachNode(Fn fn) {
+        std::vector<std::thread> workers;
+        for (auto& shard : d_shards) {
+            workers.emplace_back([&shard, &fn]() {
+                pinCurrentThread(shard.d_node.d_cpus);
+                fn(shard);
+            });
+        }
+
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    std::vector<Shard>  d_shards;
+    size_t              d_rowCount = 0;
+};
+
+#endif // __linux__
+
+/*
+    Shared program store
+
+    A POSIX shared memory segment holding compiled programs, so forked workers
+    on a host compile each expression once. One process creates the segment and
+    publishes programs; any number of processes open it read-only and look
+    programs up without locks. Everything in the segment is addressed by offset,
+    so it can be mapped at any address, and variables are stored by name since
+    symbol table IDs are private to each process.
+
+    Segment layout:
+        SharedStoreHeader
+        SharedIndexEntry[index slots]   open addressing by expression hash, 0 = empty
+        data area                       SharedProgramRecord entries, 8-byte aligned:
+            record, expression text, Instruction[code length],
+            per variable: uint32 name length, name bytes
+
+    A record is fully written before its index entry's hash is stored with
+    release ordering, so a reader that observes the hash sees the whole record.
+*/
+
+#ifdef __linux__
+
+constexpr char SHARED_STORE_MAGIC[8] = { 'S', 'Y', 'S', 'H', 'M', '0', '0', '1' };
+
+struct SharedStoreHeader {
+    char                    d_magic[8];
+    uint64_t                d_totalBytes;
+    uint64_t                d_dataOffset;
+    uint32_t                d_indexSlots;
+    std::atomic<uint32_t>   d_programCount;
+    std::atomic<uint64_t>   d_dataUsed;
+};
+
+struct SharedIndexEntry {
+    std::atomic<uint64_t>   d_hash;
+    uint64_t                d_offset;   // Of the record, from the start of the segment
+};
+
+struct SharedProgramRecord {
+    uint64_t d_hash;
+    uint32_t d_textLength;
+    uint32_t d_codeLength;
+    uint32_t d_variableCount;
+    uint32_t d_maxStackDepth;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared store needs lock-free 64-bit atomics");
+
+// Read-only view of a program living in the shared segment
+struct SharedProgram {
+    const Instruction*  d_code = nullptr;
+    size_t              d_codeLength = 0;
+    size_t              d_maxStackDepth = 0;
+    const char*         d_variables = nullptr;  // Length-prefixed names
+    size_t              d_variableCount = 0;
+
+    std::vector<std::string> variableNames() const {
+        std::vector<std::string> names;
+        const char* cursor = d_variables;
+
+        for (size_t i = 0; i < d_variableCount; ++i) {
+            uint32_t length = 0;
+            std::memcpy(&length, cursor, sizeof(length));
+            names.emplace_back(cursor + sizeof(length), length);
+            cursor += sizeof(length) + length;
+        }
+
+        return names;
+    }
+};
+
+// 'variables' holds one value per variable slot, in the order of variableNames()
+int64_t evaluateSharedProgram(const SharedProgram& program, const int64_t* variables) {
+    return evaluateInstructions(program.d_code, program.d_codeLength, program.d_maxStackDepth, variables);
+}
+
+class SharedProgramStore {
+public:
+    // Creates (or replaces) the named segment, the creating process is the only writer
+    static std::unique_ptr<SharedProgramStore> create(const std::string& name, size_t dataBytes, uint32_t indexSlots) {
+        size_t slots = 1;
+        while (slots < indexSlots)
+            slots *= 2;
+
+        size_t dataOffset = alignUp(sizeof(SharedStoreHeader) + slots * sizeof(SharedIndexEntry));
+        size_t totalBytes = dataOffset + alignUp(dataBytes);
+
+        shm_unlink(name.c_str());
+        int descriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (descriptor < 0 || ftruncate(descriptor, static_cast<off_t>(totalBytes)) != 0) {
+            std::cout << "Failed to create shared program store " << name << "\n";
+            if (descriptor >= 0)
+                close(descriptor);
+            return nullptr;
+        }
+
+        void* memory = mmap(nullptr, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+        if (memory == MAP_FAILED)
+            return nullptr;
+
+        // ftruncate zero-fills, so every index entry starts out empty
+        auto header = static_cast<SharedStoreHeader*>(memory);
+        header->d_totalBytes = totalBytes;
+        header->d_dataOffset = dataOffset;
+        header->d_indexSlots = static_cast<uint32_t>(slots);
+        header->d_programCount.store(0);
+        header->d_dataUsed.store(0);
+        std::memcpy(header->d_magic, SHARED_STORE_MAGIC, sizeof(SHARED_STORE_MAGIC));
+
+        return std::unique_ptr<SharedProgramStore>(new SharedProgramStore(memory, totalBytes, true));
+    }
+
+    // Maps an existing segment read-only
+    static std::unique_ptr<SharedProgramStore> open(const std::string& name) {
+        int descriptor = shm_open(name.c_str(), O_RDONLY, 0);
+        struct stat status = {};
+        if (descriptor < 0 || fstat(descriptor, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(SharedStoreHeader)) {
+            std::cout << "Failed to open shared program store " << name << "\n";
+            if (descriptor >= 0)
+                close(descriptor);
+            return nullptr;
+        }
+
+        size_t totalBytes = static_cast<size_t>(status.st_size);
+        void* memory = mmap(nullptr, totalBytes, PROT_READ, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+        if (memory == MAP_FAILED)
+            return nullptr;
+
+        auto header = static_cast<const SharedStoreHeader*>(memory);
+        if (std::memcmp(header->d_magic, SHARED_STORE_MAGIC, sizeof(SHARED_STORE_MAGIC)) != 0 || header->d_totalBytes != totalBytes) {
+            std::cout << "Invalid shared program store " << name << "\n";
+            munmap(memory, totalBytes);
+            return nullptr;
+        }
+
+        return std::unique_ptr<SharedProgramStore>(new SharedProgramStore(memory, totalBytes, false));
+    }
+
+    static void remove(const std::string& name) { shm_unlink(name.c_str()); }
+
+    ~SharedProgramStore() { munmap(d_memory, d_totalBytes); }
+
+    SharedProgramStore(const SharedProgramStore&) = delete;
+    SharedProgramStore& operator=(const SharedProgramStore&) = delete;
+
+    size_t programCount() const { return header()->d_programCount.load(std::memory_order_acquire); }
+
+    // Returns false if the expression isn't in the store
+    bool lookup(const std::string& expression, SharedProgram& program) const {
+        uint64_t hash = expressionHash(expression);
+        uint32_t mask = header()->d_indexSlots - 1;
+
+        for (uint32_t probe = 0; probe <= mask; ++probe) {
+            auto& entry = index()[(hash + probe) & mask];
+            uint64_t entryHash = entry.d_hash.load(std::memory_order_acquire);
+            if (entryHash == 0)
+                return false;
+            if (entryHash != hash)
+                continue;
+
+            auto record = reinterpret_cast<const SharedProgramRecord*>(bytes() + entry.d_offset);
+            const char* text = reinterpret_cast<const char*>(record + 1);
+            if (std::string_view(text, record->d_textLength) != expression)
+                continue;
+
+            program.d_code = reinterpret_cast<const Instruction*>(bytes() + alignUp(entry.d_offset + sizeof(*record) + record->d_textLength));
+            program.d_codeLength = record->d_codeLength;
+            program.d_maxStackDepth = record->d_maxStackDepth;
+            program.d_variables = reinterpret_cast<const char*>(program.d_code + record->d_codeLength);
+            program.d_variableCount = record->d_variableCount;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Copies a valid program into the store, returns false if the store is full or read-only.
+    // Lifted programs are rejected, the store has no room for their literal arrays.
+    bool publish(const std::string& expression, const CompiledExpression& program) {
+        SharedProgram existing;
+        if (!d_writable || !program.valid())
+            return false;
+        if (program.d_literalCount != 0) {
+            std::cout << "Cannot share a program with lifted literals: " << expression << "\n";
+            return false;
+        }
+        if (lookup(expression, existing))
+            return true;
+
+        size_t variableBytes = 0;
+        for (auto& name : program.d_variables)
+            variableBytes += sizeof(uint32_t) + name.size();
+
+        size_t codeOffset = alignUp(sizeof(SharedProgramRecord) + expression.size());
+        size_t recordBytes = alignUp(codeOffset + program.d_code.size() * sizeof(Instruction) + variableBytes);
+
+        auto header = mutableHeader();
+        size_t used = header->d_dataUsed.load(std::memory_order_relaxed);
+        if (header->d_dataOffset + used + recordBytes > d_totalBytes ||
+            header->d_programCount.load(std::memory_order_relaxed) * 2 >= header->d_indexSlots)
+            return false;
+
+        // Write the record first
+        size_t offset = header->d_dataOffset + used;
+        char* destination = d_memory + offset;
+        SharedProgramRecord record = {
+            expressionHash(expression),
+            static_cast<uint32_t>(expression.size()),
+            static_cast<uint32_t>(program.d_code.size()),
+            static_cast<uint32_t>(program.d_variables.size()),
+            static_cast<uint32_t>(program.d_maxStackDepth)
+        };
+        std::memcpy(destination, &record, sizeof(record));
+        std::memcpy(destination + sizeof(record), expression.data(), expression.size());
+        std::memcpy(destination + codeOffset, program.d_code.data(), program.d_code.size() * sizeof(Instruction));
+
+        char* names = destination + codeOffset + program.d_code.size() * sizeof(Instruction);
+        for (auto& name : program.d_variables) {
+            uint32_t length = static_cast<uint32_t>(name.size());
+            std::memcpy(names, &length, sizeof(length));
+            std::memcpy(names + sizeof(length), name.data(), name.size());
+            names += sizeof(length) + name.size();
+        }
+
+        header->d_dataUsed.store(used + recordBytes, std::memory_order_relaxed);
+
+        // Then make it visible through the index
+        uint32_t mask = header->d_indexSlots - 1;
+        for (uint64_t slot = record.d_hash;; ++slot) {
+            auto& entry = mutableIndex()[slot & mask];
+            if (entry.d_hash.load(std::memory_order_relaxed) == 0) {
+                entry.d_offset = offset;
+                entry.d_hash.store(record.d_hash, std::memory_order_release);
+                break;
+            }
+        }
+
+        header->d_programCount.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    SharedProgramStore(void* memory, size_t totalBytes, bool writable)
+        : d_memory(static_cast<char*>(memory)), d_totalBytes(totalBytes), d_writable(writable) {}
+
+    static size_t alignUp(size_t value) { return (value + 7) & ~static_cast<size_t>(7); }
+
+    // Zero marks an empty index entry, so it is never used as a hash
+    static uint64_t expressionHash(const std::string& expression) {
+        uint64_t hash = hashString(expression);
+        return hash == 0 ? 1 : hash;
+    }
+
+    const char* bytes() const { return d_memory; }
+    const SharedStoreHeader* header() const { return reinterpret_cast<const SharedStoreHeader*>(d_memory); }
+    const SharedIndexEntry* index() const { return reinterpret_cast<const SharedIndexEntry*>(d_memory + sizeof(SharedStoreHeader)); }
+    SharedStoreHeader* mutableHeader() { return reinterpret_cast<SharedStoreHeader*>(d_memory); }
+    SharedIndexEntry* mutableIndex() { return reinterpret_cast<SharedIndexEntry*>(d_memory + sizeof(SharedStoreHeader)); }
+
+    char*   d_memory;
+    size_t  d_totalBytes;
+    bool    d_writable;
+};
+
+#endif
+
+/*
+    Hot reload
+
+    A rule set is compiled into an immutable ExpressionSet off the hot path and
+    published with a single atomic pointer swap (RCU style). Readers never
+    block: they enter an epoch, load the current set and use it until they
+    leave. A replaced set is retired with the epoch at which it was unlinked
+    and freed once every reader active at that point has left, either by the
+    next retire or by the last such reader on its way out.
+
+    Guards nest: only a thread's outermost guard publishes and clears its
+    epoch, so a read inside a read keeps the outer set alive.
+*/
+
+constexpr size_t EPOCH_READER_SLOTS = 256;
+
+class EpochDomain {
+public:
+    static constexpr uint64_t INACTIVE = std::numeric_limits<uint64_t>::max();
+
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    void enter() {
+        auto& reader = registration();
+        if (reader.d_nesting++ == 0)
+            reader.d_slot->d_epoch.store(d_epoch.load());
+    }
+
+    // Leaving the outermost guard frees what no reader holds any more, unless another
+    // thread is already reclaiming, so readers still never block
+    void leave() {
+        auto& reader = registration();
+        if (--reader.d_nesting != 0)
+            return;
+
+        reader.d_slot->d_epoch.store(INACTIVE);
+        if (d_pendingCount.load(std::memory_order_relaxed) != 0) {
+            std::unique_lock<std::mutex> lock(d_retiredMutex, std::try_to_lock);
+            if (lock.owns_lock())
+                reclaimLocked();
+        }
+    }
+
+    // Queues 'deleter' to run once no reader can still hold what it frees
+    void retire(std::function<void()> deleter) {
+        std::lock_guard<std::mutex> lock(d_retiredMutex);
+        d_retired.push_back({ d_epoch.fetch_add(1) + 1, std::move(deleter) });
+        reclaimLocked();
+    }
+
+    void reclaim() {
+        std::lock_guard<std::mutex> lock(d_retiredMutex);
+        reclaimLocked();
+    }
+
+    size_t retiredCount() {
+        std::lock_guard<std::mutex> lock(d_retiredMutex);
+        return d_retired.size();
+    }
+
+private:
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t>   d_epoch{ INACTIVE };
+        std::atomic<bool>       d_inUse{ false };
+    };
+
+    // Claims a slot for the calling thread on first use and frees it on thread exit
+    struct SlotRegistration {
+        ReaderSlot* d_slot = nullptr;
+        uint32_t    d_nesting = 0;  // Guards currently open on this thread
+
+        ~SlotRegistration() {
+            if (d_slot) {
+                d_slot->d_epoch.store(INACTIVE);
+                d_slot->d_inUse.store(false);
+            }
+        }
+    };
+
+    SlotRegistration& registration() {
+        thread_local SlotRegistration registration;
+        if (registration.d_slot)
+            return registration;
+
+        for (auto& slot : d_slots) {
+            bool expected = false;
+            if (slot.d_inUse.compare_exchange_strong(expected, true)) {
+                registration.d_slot = &slot;
+                return registration;
+            }
+        }
+
+        // More concurrent reader threads than slots is a configuration error
+        std::cout << "Out of epoch reader slots!\n";
+        std::abort();
+    }
+
+    uint64_t oldestActiveEpoch() const {
+        uint64_t oldest = INACTIVE;
+        for (auto& slot : d_slots)
+            oldest = std::min(oldest, slot.d_epoch.load());
+
+        return oldest;
+    }
+
+    void reclaimLocked() {
+        uint64_t oldest = oldestActiveEpoch();
+
+        // A reader that entered at or after the retire epoch loaded the replacement
+        auto reclaimable = std::stable_partition(d_retired.begin(), d_retired.end(),
+            [oldest](const auto& retired) { return retired.first > oldest; });
+
+        for (auto it = reclaimable; it != d_retired.end(); ++it)
+            it->second();
+        d_retired.erase(reclaimable, d_retired.end());
+        d_pendingCount.store(d_retired.size(), std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t>                                   d_epoch{ 1 };
+    ReaderSlot                                              d_slots[EPOCH_READER_SLOTS];
+    std::mutex                                              d_retiredMutex;
+    std::vector<std::pair<uint64_t, std::function<void()>>> d_retired;
+    std::atomic<size_t>                                     d_pendingCount{ 0 };    // d_retired.size() for lock-free checks
+};
+
+class EpochGuard {
+public:
+    EpochGuard() { EpochDomain::instance().enter(); }
+    ~EpochGuard() { EpochDomain::instance().leave(); }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+// Immutable compiled rule set, programs are addressed by their position in the rule list
+struct ExpressionSet {
+    uint64_t                        d_version = 0;
+    std::vector<std::string>        d_expressions;
+    std::vector<CompiledExpression> d_programs;
+
+    // Returns null if any expression fails to compile
+    static std::unique_ptr<ExpressionSet> compile(const std::vector<std::string>& expressions, uint64_t version) {
+        auto set = std::make_unique<ExpressionSet>();
+        set->d_version = version;
+        set->d_expressions = expressions;
+
+        for (auto& expression : expressions) {
+            auto tokens = tokenizeExpression(expression);
+            auto program = compileExpression(shuntingYardAlgorithm(tokens));
+            if (!program.valid()) {
+                std::cout << "Failed to compile rule: " << expression << "\n";
+                return nullptr;
+            }
+
+            set->d_programs.push_back(std::move(program));
+        }
+
+        return set;
+    }
+};
+
+class HotExpressionSet {
+public:
+    HotExpressionSet() : d_current(new ExpressionSet()) {}
+
+    // Must only be destroyed once no thread reads it any more
+    ~HotExpressionSet() {
+        EpochDomain::instance().reclaim();
+        delete d_current.load();
+    }
+
+    HotExpressionSet(const HotExpressionSet&) = delete;
+    HotExpressionSet& operator=(const HotExpressionSet&) = delete;
+
+    // Runs 'fn' with the current set; the set stays alive until 'fn' returns. Never blocks.
+    template <typename Fn>
+    auto read(Fn&& fn) const {
+        EpochGuard guard;
+        return fn(*d_current.load());
+    }
+
+    uint64_t version() const { return read([](const ExpressionSet& set) { return set.d_version; }); }
+
+    // Atomically replaces the current set, the previous one is freed once unreferenced
+    void publish(std::unique_ptr<ExpressionSet> set) {
+        std::lock_guard<std::mutex> lock(d_writerMutex);
+        set->d_version = ++d_version;
+
+        ExpressionSet* previous = d_current.exchange(set.release());
+        EpochDomain::instance().retire([previous]() { delete previous; });
+    }
+
+    // Compiles the rules on a background thread and publishes them if they all compile
+    std::future<bool> reloadAsync(std::vector<std::string> expressions) {
+        return std::async(std::launch::async, [this, expressions = std::move(expressions)]() {
+            auto set = ExpressionSet::compile(expressions, 0);
+            if (!set)
+                return false;
+
+            publish(std::move(set));
+            return true;
+        });
+    }
+
+private:
+    std::atomic<ExpressionSet*> d_current;
+    std::mutex                  d_writerMutex;
+    uint64_t                    d_version = 0;
+};
+
+/*
+    Execution budgets
+
+    Parsing and evaluating untrusted expressions can be bounded by a budget on
+    the token count, the nesting depth (operator stack depth of the parser) and
+    the number of executed instructions, and can be cancelled cooperatively.
+    Limits are checked once per lexed window or evaluated block rather than per
+    token or row, and exceeding one aborts with its own status. A token longer
+    than d_lexWindow widens the window, but never past d_maxLexWindow, so one
+    huge token cannot make the lexer scan unbounded input in a single step.
+*/
+
+constexpr size_t BUDGET_LEX_WINDOW = 4096;
+constexpr size_t BUDGET_MAX_LEX_WINDOW = 64 * 1024;
+
+struct ExecutionBudget {
+    size_t                      d_maxTokens = std::numeric_limits<size_t>::max();
+    size_t                      d_maxNestingDepth = std::numeric_limits<size_t>::max();
+    size_t                      d_maxInstructions = std::numeric_limits<size_t>::max();
+    size_t                      d_lexWindow = BUDGET_LEX_WINDOW;
+    size_t                      d_maxLexWindow = BUDGET_MAX_LEX_WINDOW;
+    const std::atomic<bool>*    d_cancelled = nullptr;
+
+    bool cancelled() const { return d_cancelled && d_cancelled->load(std::memory_order_relaxed); }
+};
+
+enum class BudgetStatus {
+    Ok,
+    Malformed,
+    TokenLimitExceeded,
+    TokenTooLong,
+    DepthLimitExceeded,
+    InstructionLimitExceeded,
+    Cancelled
+};
+
+const char* describeBudgetStatus(BudgetStatus status) {
+    switch (status) {
+    case BudgetStatus::Ok:                          return "ok";
+    case BudgetStatus::Malformed:                   return "malformed expression";
+    case BudgetStatus::TokenLimitExceeded:          return "token limit exceeded";
+    case BudgetStatus::TokenTooLong:                return "token longer than the lex window";
+    case BudgetStatus::DepthLimitExceeded:          return "nesting depth limit exceeded";
+    case BudgetStatus::InstructionLimitExceeded:    return "instruction limit exceeded";
+    case BudgetStatus::Cancelled:                   return "cancelled";
+    default:                                        return "unknown";
+    }
+}
+
+// Lexes, parses and compiles 'expression' within the budget
+BudgetStatus compileWithBudget(std::string_view expression, const ExecutionBudget& budget, CompiledExpression& program) {
+    std::stack<TokenRef> outputStack;
+    ShuntingYard parser([&outputStack](const TokenRef& token) { outputStack.push(token); });
+
+    std::vector<TokenRef> tokens;
+    size_t tokenCount = 0;
+    size_t position = 0;
+    size_t maxWindow = std::max<size_t>(budget.d_maxLexWindow, 1);
+    size_t window = std::clamp<size_t>(budget.d_lexWindow, 1, maxWindow);
+
+    while (position < expression.size()) {
+        if (budget.cancelled())
+            return BudgetStatus::Cancelled;
+
+        size_t end = position + std::min(window, expression.size() - position);
+        tokens.clear();
+        size_t consumed = lexTokens(expression.substr(position, end - position), tokens, end == expression.size(), position);
+        if (consumed == std::string::npos)
+            return BudgetStatus::Malformed;
+
+        // A single token longer than the window, widen it until the token fits or the budget runs out
+        if (consumed == 0) {
+            if (window == maxWindow)
+                return BudgetStatus::TokenTooLong;
+
+            window = window <= maxWindow / 2 ? window * 2 : maxWindow;
+            continue;
+        }
+
+        position += consumed;
+        tokenCount += tokens.size();
+        if (tokenCount > budget.d_maxTokens)
+            return BudgetStatus::TokenLimitExceeded;
+
+        for (auto& token : tokens) {
+            if (!parser.push(token))
+                return BudgetStatus::Malformed;
+        }
+
+        if (parser.maxDepth() > budget.d_maxNestingDepth)
+            return BudgetStatus::DepthLimitExceeded;
+    }
+
+    if (!parser.finish())
+        return BudgetStatus::Malformed;
+
+    program = compileExpression(outputStack);
+    if (!program.valid())
+        return BudgetStatus::Malformed;
+
+    // A program has no loops, so one evaluation runs exactly its instruction count
+    if (program.d_code.size() > budget.d_maxInstructions)
+        return BudgetStatus::InstructionLimitExceeded;
+
+    return BudgetStatus::Ok;
+}
+
+BudgetStatus evaluateWithBudget(const CompiledExpression& program, const int64_t* variables,
+                                const ExecutionBudget& budget, int64_t& result) {
+    if (budget.cancelled())
+        return BudgetStatus::Cancelled;
+    if (program.d_code.size() > budget.d_maxInstructions)
+        return BudgetStatus::InstructionLimitExceeded;
+
+    result = evaluateCompiledExpression(program, variables);
+    return BudgetStatus::Ok;
+}
+
+// Like evaluateBatch, rows evaluated before the budget ran out keep their results
+BudgetStatus evaluateBatchWithBudget(const CompiledExpression& program, const ColumnBatch& batch,
+                                     int64_t* results, const ExecutionBudget& budget) {
+    std::vector<int64_t> scratch(program.d_maxStackDepth * BATCH_BLOCK_SIZE);
+    size_t executed = 0;
+    size_t blockSize = batchBlockSize(program);
+
+    for (size_t row = 0; row < batch.d_rowCount; row += blockSize) {
+        size_t count = std::min(blockSize, batch.d_rowCount - row);
+
+        if (budget.cancelled())
+            return BudgetStatus::Cancelled;
+
+        executed += program.d_code.size() * count;
+        if (executed > budget.d_maxInstructions)
+            return BudgetStatus::InstructionLimitExceeded;
+
+        evaluateBlock(program, batch, row, count, nullptr, scratch.data(), results + row);
+    }
+
+    return BudgetStatus::Ok;
+}
+
+#if defined(__cpp_impl_coroutine)
+/*
+    Asynchronous evaluation
+
+    Awaitable parseAsync/evaluateAsync entry points for C++20 coroutine callers.
+    Small work completes inline inside await_ready so the caller never hops
+    threads; larger work goes to a worker pool and the caller is resumed on a
+    worker once it is done. Evaluations of the same program are gathered into
+    one columnar batch, so many concurrent awaiters cost a single evaluateBatch
+    call rather than one interpreter run each: a queued evaluation waits up to
+    ASYNC_BATCH_WINDOW for others to join unless a full batch is already there.
+    The awaiters of a batch are resumed as separate pool tasks, so one long
+    continuation does not hold up the rest.
+*/
+
+constexpr size_t ASYNC_INLINE_PARSE_LENGTH = 4096;  // Characters
+constexpr size_t ASYNC_INLINE_INSTRUCTIONS = 64;
+constexpr size_t ASYNC_BATCH_TARGET = 256;          // Evaluations that start a batch without waiting
+constexpr auto ASYNC_BATCH_WINDOW = std::chrono::microseconds(50);
+
+class AsyncEvaluator {
+public:
+    struct Evaluation {
+        const CompiledExpression*   d_program = nullptr;
+        const int64_t*              d_variables = nullptr;
+        int64_t                     d_result = 0;
+        std::coroutine_handle<>     d_continuation;
+        std::chrono::steady_clock::time_point d_submitted;
+    };
+
+    struct Stats {
+        size_t d_evaluations = 0;
+        size_t d_batches = 0;
+    };
+
+    static AsyncEvaluator& instance() {
+        static AsyncEvaluator evaluator(std::max(1u, std::thread::hardware_concurrency()));
+        return evaluator;
+    }
+
+    explicit AsyncEvaluator(size_t threadCount) {
+        for (size_t i = 0; i < threadCount; ++i)
+            d_workers.emplace_back([this]() { run(); });
+    }
+
+    // Finishes all queued work before returning
+    ~AsyncEvaluator() {
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            d_stopping = true;
+        }
+
+        d_wakeup.notify_all();
+        for (auto& worker : d_workers)
+            worker.join();
+    }
+
+    AsyncEvaluator(const AsyncEvaluator&) = delete;
+    AsyncEvaluator& operator=(const AsyncEvaluator&) = delete;
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            d_tasks.push_back(std::move(task));
+        }
+        d_wakeup.notify_one();
+    }
+
+    void submit(Evaluation* evaluation) {
+        evaluation->d_submitted = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(d_mutex);
+            d_evaluations.push_back(evaluation);
+        }
+        d_wakeup.notify_one();
+    }
+
+    Stats stats() const {
+        return { d_evaluationCount.load(std::memory_order_relaxed), d_batchCount.load(std::memory_order_relaxed) };
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(d_mutex);
+
+        while (true) {
+            d_wakeup.wait(lock, [this]() { return d_stopping || !d_tasks.empty() || !d_evaluations.empty(); });
+
+            // Tasks first, they include the resumptions of finished batches
+            if (!d_tasks.empty()) {
+                auto task = std::move(d_tasks.front());
+                d_tasks.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+            } else if (!d_evaluations.empty()) {
+                // Give more evaluations a short window to join the batch
+                auto deadline = d_evaluations.front()->d_submitted + ASYNC_BATCH_WINDOW;
+                if (!d_stopping && d_evaluations.size() < ASYNC_BATCH_TARGET && std::chrono::steady_clock::now() < deadline) {
+                    d_wakeup.wait_until(lock, deadline, [this]() {
+                        return d_stopping || !d_tasks.empty() || d_evaluations.size() >= ASYNC_BATCH_TARGET;
+                    });
+                    continue;
+                }
+
+                auto group = takeGroupLocked();
+                lock.unlock();
+                evaluateGroup(group);
+                lock.lock();
+            } else {
+                return;
+            }
+        }
+    }
+
+    // Removes up to one block of queued evaluations sharing the oldest one's program
+    std::vector<Evaluation*> takeGroupLocked() {
+        const CompiledExpression* program = d_evaluations.front()->d_program;
+        std::vector<Evaluation*> group;
+        std::deque<Evaluation*> remaining;
+
+        for (auto* evaluation : d_evaluations) {
+            if (evaluation->d_program == program && group.size() < BATCH_BLOCK_SIZE)
+                group.push_back(evaluation);
+            else
+                remaining.push_back(evaluation);
+        }
+
+        d_evaluations.swap(remaining);
+        return group;
+    }
+
+    void evaluateGroup(const std::vector<Evaluation*>& group) {
+        const CompiledExpression& program = *group.front()->d_program;
+        d_evaluationCount.fetch_add(group.size(), std::memory_order_relaxed);
+        d_batchCount.fetch_add(1, std::memory_order_relaxed);
+
+        if (group.size() == 1) {
+            group.front()->d_result = evaluateCompiledExpression(program, group.front()->d_variables);
+        } else {
+            // Transpose the awaiters' rows into columns
+            size_t slotCount = program.d_variables.size();
+            std::vector<int64_t> values(slotCount * group.size());
+            std::vector<int64_t> results(group.size());
+
+            ColumnBatch batch;
+            batch.d_rowCount = group.size();
+            for (size_t slot = 0; slot < slotCount; ++slot) {
+                int64_t* column = values.data() + slot * group.size();
+                for (size_t row = 0; row < group.size(); ++row)
+                    column[row] = group[row]->d_variables[slot];
+                batch.d_columns.push_back(column);
+            }
+
+            evaluateBatch(program, batch, results.data());
+            for (size_t row = 0; row < group.size(); ++row)
+                group[row]->d_result = results[row];
+        }
+
+        // A resumed caller may destroy its Evaluation, so results are all stored first. The other
+        // awaiters are posted to the pool before this worker runs the first one's continuation.
+        std::vector<std::coroutine_handle<>> continuations;
+        for (auto* evaluation : group)
+            continuations.push_back(evaluation->d_continuation);
+
+        if (continuations.size() > 1) {
+            {
+                std::lock_guard<std::mutex> lock(d_mutex);
+                for (size_t i = 1; i < continuations.size(); ++i)
+                    d_tasks.push_back([continuation = continuations[i]]() { continuation.resume(); });
+            }
+            d_wakeup.notify_all();
+        }
+
+        continuations.front().resume();
+    }
+
+    std::vector<std::thread>    d_workers;
+    std::mutex                  d_mutex;
+    std::condition_variable     d_wakeup;
+    std::deque<std::function<void()>> d_tasks;
+    std::deque<Evaluation*>     d_evaluations;
+    bool                        d_stopping = false;
+    std::atomic<size_t>         d_evaluationCount{ 0 };
+    std::atomic<size_t>         d_batchCount{ 0 };
+};
+
+class ParseAwaitable {
+public:
+    explicit ParseAwaitable(std::string expression) : d_expression(std::move(expression)) {}
+
+    bool await_ready() {
+        if (d_expression.size() > ASYNC_INLINE_PARSE_LENGTH)
+            return false;
+
+        compile();
+        return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> continuation) {
+        AsyncEvaluator::instance().submit([this, continuation]() {
+            compile();
+            continuation.resume();
+        });
+    }
+
+    // An invalid program if the expression is malformed
+    CompiledExpression await_resume() { return std::move(d_program); }
+
+private:
+    void compile() {
+        auto tokens = tokenizeExpression(d_expression);
+        d_program = compileExpression(shuntingYardAlgorithm(tokens));
+    }
+
+    std::string         d_expression;
+    CompiledExpression  d_program;
+};
+
+class EvaluateAwaitable {
+public:
+    // Evaluations are batched without a literal array, so 'program' must not have lifted literals
+    EvaluateAwaitable(const CompiledExpression& program, const int64_t* variables) {
+        assert(program.d_literalCount == 0 && "lifted program run without its literals");
+        d_evaluation.d_program = &program;
+        d_evaluation.d_variables = variables;
+    }
+
+    bool await_ready() {
+        if (d_evaluation.d_program->d_code.size() > ASYNC_INLINE_INSTRUCTIONS)
+            return false;
+
+        d_evaluation.d_result = evaluateCompiledExpression(*d_evaluation.d_program, d_evaluation.d_variables);
+        return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> continuation) {
+        d_evaluation.d_continuation = continuation;
+        AsyncEvaluator::instance().submit(&d_evaluation);
+    }
+
+    int64_t await_resume() const { return d_evaluation.d_result; }
+
+private:
+    AsyncEvaluator::Evaluation d_evaluation;
+};
+
+ParseAwaitable parseAsync(std::string expression) {
+    return ParseAwaitable(std::move(expression));
+}
+
+// 'program' and 'variables' must stay alive until the await completes
+EvaluateAwaitable evaluateAsync(const CompiledExpression& program, const int64_t* variables) {
+    return EvaluateAwaitable(program, variables);
+}
+#endif
+
+/*
+    Ahead-of-time code generation
+
+    Turns a file of expressions (one per line) into a standalone C++ source file
+    with one function per expression, a batch variant evaluating a whole set of
+    columns and a dispatch table by expression ID, the line's index among the
+    non-empty lines. Each compiled program is emitted as straight-line code on
+    local temporaries, so the C++ compiler sees the whole expression and can
+    fold, schedule and vectorize it. The helpers reproduce the interpreter's
+    wrapping and division semantics exactly.
+*/
+
+static const char* const CODEGEN_PRELUDE = R"(#include <cstddef>
+#include <cstdint>
+
+namespace {
+
+inline int64_t sy_add(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)); }
+inline int64_t sy_subtract(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b)); }
+inline int64_t sy_multiply(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)); }
+inline int64_t sy_negate(int64_t a) { return static_cast<int64_t>(0 - static_cast<uint64_t>(a)); }
+inline int64_t sy_divide(int64_t a, int64_t b) { return b == 0 ? 0 : b == -1 ? sy_negate(a) : a / b; }
+inline int64_t sy_modulo(int64_t a, int64_t b) { return (b == 0 || b == -1) ? 0 : a % b; }
+inline int64_t sy_shift_left(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) << (b & 63)); }
+inline int64_t sy_shift_right(int64_t a, int64_t b) { return a >> (b & 63); }
+
+inline int64_t sy_power(int64_t a, int64_t b) {
+    if (b < 0)
+        return a == 1 ? 1 : a == -1 ? ((b & 1) ? -1 : 1) : 0;
+
+    uint64_t base = static_cast<uint64_t>(a);
+    uint64_t result = 1;
+    for (uint64_t exponent = static_cast<uint64_t>(b); exponent; exponent >>= 1) {
+        if (exponent & 1)
+            result *= base;
+        base *= base;
+    }
+
+    return static_cast<int64_t>(result);
+}
+
+} // namespace
+)";
+
+// INT64_MIN has no literal form in C++
+std::string generateInt64Literal(int64_t value) {
+    return value == std::numeric_limits<int64_t>::min()
+        ? "(-9223372036854775807 - 1)"
+        : "static_cast<int64_t>(" + std::to_string(value) + "ll)";
+}
+
+// C++ expression computing 'instruction' from the temporaries holding its operands
+std::string generateOperation(const Instruction& instruction, const std::string& lhs, const std::string& rhs) {
+    switch (instruction.d_opcode) {
+    case OpCode::Negate:        return "sy_negate(" + rhs + ")";
+    case OpCode::LogicalNot:    return "static_cast<int64_t>(" + rhs + " == 0)";
+    case OpCode::BitwiseNot:    return "~" + rhs;
+    case OpCode::PowerConstant:
+        // Small exponents become multiply chains here as in the interpreter
+        switch (instruction.d_operand) {
+        case 0:     return "(static_cast<void>(" + rhs + "), static_cast<int64_t>(1))";
+        case 1:     return rhs;
+        case 2:     return "sy_multiply(" + rhs + ", " + rhs + ")";
+        case 3:     return "sy_multiply(sy_multiply(" + rhs + ", " + rhs + "), " + rhs + ")";
+        case 4:     return "sy_multiply(sy_multiply(" + rhs + ", " + rhs + "), sy_multiply(" + rhs + ", " + rhs + "))";
+        default:    return "sy_power(" + rhs + ", " + std::to_string(instruction.d_operand) + ")";
+        }
+    case OpCode::Add:           return "sy_add(" + lhs + ", " + rhs + ")";
+    case OpCode::Subtract:      return "sy_subtract(" + lhs + ", " + rhs + ")";
+    case OpCode::Multiply:      return "sy_multiply(" + lhs + ", " + rhs + ")";
+    case OpCode::Divide:        return "sy_divide(" + lhs + ", " + rhs + ")";
+    case OpCode::Modulo:        return "sy_modulo(" + lhs + ", " + rhs + ")";
+    case OpCode::Power:         return "sy_power(" + lhs + ", " + rhs + ")";
+    case OpCode::ShiftLeft:     return "sy_shift_left(" + lhs + ", " + rhs + ")";
+    case OpCode::ShiftRight:    return "sy_shift_right(" + lhs + ", " + rhs + ")";
+    case OpCode::BitwiseAnd:    return "(" + lhs + " & " + rhs + ")";
+    case OpCode::BitwiseOr:     return "(" + lhs + " | " + rhs + ")";
+    case OpCode::BitwiseXor:    return "(" + lhs + " ^ " + rhs + ")";
+    case OpCode::Less:          return "static_cast<int64_t>(" + lhs + " < " + rhs + ")";
+    case OpCode::LessEqual:     return "static_cast<int64_t>(" + lhs + " <= " + rhs + ")";
+    case OpCode::Greater:       return "static_cast<int64_t>(" + lhs + " > " + rhs + ")";
+    case OpCode::GreaterEqual:  return "static_cast<int64_t>(" + lhs + " >= " + rhs + ")";
+    case OpCode::Equal:         return "static_cast<int64_t>(" + lhs + " == " + rhs + ")";
+    case OpCode::NotEqual:      return "static_cast<int64_t>(" + lhs + " != " + rhs + ")";
+    default:                    return "0";
+    }
+}
+
+// Emits the program as one temporary per instruction, 'load' gives the C++ value of a variable slot
+template <typename Load>
+void generateBody(const CompiledExpression& program, std::ostream& out, const char* indent, Load load) {
+    std::vector<std::string> stack;
+    size_t temporaries = 0;
+
+    for (auto& instruction : program.d_code) {
+        std::string value;
+        switch (instruction.d_opcode) {
+        case OpCode::PushConstant:
+            value = generateInt64Literal(instruction.d_operand);
+            break;
+        case OpCode::PushVariable:
+            value = load(static_cast<size_t>(instruction.d_operand));
+            break;
+        default:
+            if (operandCount(instruction.d_opcode) == 1) {
+                value = generateOperation(instruction, {}, stack.back());
+                stack.pop_back();
+            } else {
+                std::string rhs = stack.back();
+                stack.pop_back();
+                value = generateOperation(instruction, stack.back(), rhs);
+                stack.pop_back();
+            }
+            break;
+        }
+
+        std::string name = "t" + std::to_string(temporaries++);
+        out << indent << "const int64_t " << name << " = " << value << ";\n";
+        stack.push_back(name);
+    }
+
+    out << indent << "return " << stack.back() << ";\n";
+}
+
+std::string escapeStringLiteral(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+bool generateExpressionSource(const std::vector<std::string>& expressions, std::ostream& out, const std::string& nameSpace) {
+    std::vector<CompiledExpression> programs;
+    for (size_t id = 0; id < expressions.size(); ++id) {
+        auto tokens = tokenizeExpression(expressions[id]);
+        auto program = compileExpression(shuntingYardAlgorithm(tokens));
+        if (!program.valid()) {
+            std::cout << "Failed to compile expression " << id << ": " << expressions[id] << "\n";
+            return false;
+        }
+
+        programs.push_back(std::move(program));
+    }
+
+    out << "// Generated by ShuntingYardAlgorithm --codegen, do not edit.\n";
+    out << "// Variables are passed by slot, in order of first use; see Expression::variables.\n\n";
+    out << CODEGEN_PRELUDE << "\n";
+    out << "namespace " << nameSpace << " {\n\n";
+
+    for (size_t id = 0; id < programs.size(); ++id) {
+        auto& program = programs[id];
+        out << "// " << id << ": " << expressions[id] << "\n";
+        out << "inline int64_t expression" << id << "(const int64_t* variables) {\n";
+        if (program.d_variables.empty())
+            out << "    (void)variables;\n";
+        generateBody(program, out, "    ", [](size_t slot) { return "variables[" + std::to_string(slot) + "]"; });
+        out << "}\n\n";
+
+        out << "inline int64_t expression" << id << "Row(const int64_t* const* columns, size_t row) {\n";
+        if (program.d_variables.empty())
+            out << "    (void)columns;\n    (void)row;\n";
+        generateBody(program, out, "    ", [](size_t slot) { return "columns[" + std::to_string(slot) + "][row]"; });
+        out << "}\n\n";
+
+        out << "void expression" << id << "Batch(const int64_t* const* columns, size_t rowCount, int64_t* results) {\n";
+        out << "    for (size_t row = 0; row < rowCount; ++row)\n";
+        out << "        results[row] = expression" << id << "Row(columns, row);\n";
+        out << "}\n\n";
+
+        out << "const char* const expression" << id << "Variables[] = { ";
+        for (auto& name : program.d_variables)
+            out << "\"" << name << "\", ";
+        out << "nullptr };\n\n";
+    }
+
+    out << "struct Expression {\n";
+    out << "    const char*         text;\n";
+    out << "    int64_t             (*evaluate)(const int64_t* variables);\n";
+    out << "    void                (*evaluateBatch)(const int64_t* const* columns, size_t rowCount, int64_t* results);\n";
+    out << "    const char* const*  variables;  // Slot order, null-terminated\n";
+    out << "    size_t              variableCount;\n";
+    out << "};\n\n";
+
+    out << "const Expression EXPRESSIONS[] = {\n";
+    for (size_t id = 0; id < programs.size(); ++id) {
+        out << "    { \"" << escapeStringLiteral(expressions[id]) << "\", expression" << id << ", expression" << id
+            << "Batch, expression" << id << "Variables, " << programs[id].d_variables.size() << " },\n";
+    }
+    out << "};\n\n";
+
+    out << "const size_t EXPRESSION_COUNT = " << programs.size() << ";\n\n";
+    out << "inline int64_t evaluate(size_t id, const int64_t* variables) {\n";
+    out << "    return EXPRESSIONS[id].evaluate(variables);\n";
+    out << "}\n\n";
+    out << "// 'columns' holds one pointer per variable slot, each to 'rowCount' values\n";
+    out << "inline void evaluateBatch(size_t id, const int64_t* const* columns, size_t rowCount, int64_t* results) {\n";
+    out << "    EXPRESSIONS[id].evaluateBatch(columns, rowCount, results);\n";
+    out << "}\n\n";
+    out << "} // namespace " << nameSpace << "\n";
+
+    return static_cast<bool>(out);
+}
+
+int runCodegenCommand(const std::string& inputPath, const std::string& outputPath, const std::string& nameSpace) {
+    std::ifstream input(inputPath);
+    if (!input) {
+        std::cout << "Failed to open " << inputPath << "\n";
+        return 1;
+    }
+
+    std::vector<std::string> expressions;
+    std::string line;
+    while (std::getline(input, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.find_first_not_of(" \t") != std::string::npos)
+            expressions.push_back(line);
+    }
+
+    std::ofstream output(outputPath);
+    if (!output) {
+        std::cout << "Failed to open " << outputPath << "\n";
+        return 1;
+    }
+
+    if (!generateExpressionSource(expressions, output, nameSpace))
+        return 1;
+
+    std::cout << "Generated " << expressions.size() << " expressions into " << outputPath << "\n";
+    return 0;
+}
+
+/*
+    Streaming evaluation
+
+    For expressions too large to hold as a token vector, the text is lexed one
+    chunk at a time and the postfix output of the shunting yard is applied to a
+    value stack as soon as it is emitted. Memory stays proportional to the
+    nesting depth of the expression rather than its length.
+*/
+
+constexpr size_t STREAM_CHUNK_BYTES = 64 * 1024;
+
+// Evaluates the expression read from 'input', returns false on a malformed expression
+bool evaluateExpressionStream(std::istream& input, int64_t& result, const VariableBindings* variables = nullptr) {
+    std::vector<int64_t> values;
+    bool failed = false;
+
+    auto applyToken = [&](const TokenRef& token) {
+        if (failed)
+            return;
+
+        if (token->type() == TokenType::Number) {
+            if (as<NumberToken>(token)->isFractional()) {
+                std::cout << "Decimal literal in integer expression: " << token->d_value << "\n";
+                failed = true;
+                return;
+            }
+
+            values.push_back(as<NumberToken>(token)->getIntValue());
+            return;
+        }
+
+        if (token->type() == TokenType::Variable) {
+            auto& name = as<VariableToken>(token)->name();
+            auto it = variables ? variables->find(name) : VariableBindings::const_iterator();
+            if (!variables || it == variables->end()) {
+                std::cout << "Unbound variable: " << name << "\n";
+                values.push_back(0);
+            } else {
+                values.push_back(it->second);
+            }
+            return;
+        }
+
+        auto info = token->type() == TokenType::Operator ? lookupOperator(token->d_value) : nullptr;
+        if (!info) {
+            std::cout << "Error evaluating token: " << token->toString() << "\n";
+            failed = true;
+            return;
+        }
+
+        if (as<OperatorToken>(token)->d_unary) {
+            if (values.empty()) {
+                failed = true;
+                return;
+            }
+
+            if (token->d_value == "-")
+                values.back() = applyUnaryOperator(OpCode::Negate, values.back());
+            else if (info->d_unary)
+                values.back() = applyUnaryOperator(info->d_opcode, values.back());
+            return;
+        }
+
+        if (values.size() < 2) {
+            failed = true;
+            return;
+        }
+
+        int64_t rhs = values.back();
+        values.pop_back();
+        values.back() = applyBinaryOperator(info->d_opcode, values.back(), rhs);
+    };
+
+    ShuntingYard parser(applyToken);
+    std::string pending;
+    std::vector<TokenRef> tokens;
+    size_t pendingOffset = 0;
+
+    while (!failed) {
+        size_t previous = pending.size();
+        pending.resize(previous + STREAM_CHUNK_BYTES);
+        input.read(&pending[previous], STREAM_CHUNK_BYTES);
+        pending.resize(previous + static_cast<size_t>(input.gcount()));
+
+        bool endOfInput = !input;
+
+        tokens.clear();
+        size_t consumed = lexTokens(pending, tokens, endOfInput, pendingOffset);
+        if (consumed == std::string::npos)
+            return false;
+        pending.erase(0, consumed);
+        pendingOffset += consumed;
+
+        for (auto& token : tokens) {
+            if (!parser.push(token))
+                return false;
+        }
+
+        if (endOfInput)
+            break;
+    }
+
+    if (!parser.finish())
+        return false;
+
+    if (failed || values.size() != 1) {
+        std::cout << "Malformed expression error!\n";
+        return false;
+    }
+
+    result = values.back();
+    return true;
+}
+
+/*
+    Corpus generation
+
+    Deterministic synthetic expressions for benchmarking and tuning. Every
+    expression is generated from its own generator state derived from the seed
+    and its index, so a corpus is identical whatever the thread count, and the
+    generator is iterative so arbitrarily long expressions never recurse.
+
+    Token corpus layout (pre-tokenized binary output):
+        char[8]     magic "SYTOKS01"
+        per expression: uint32 token count, then per token a uint8 kind and its payload:
+            number: int64 value, variable: uint32 index ("x<index>"),
+            operator: uint8 index into OPERATOR_TABLE, parentheses: none
+*/
+
+struct CorpusOptions {
+    uint64_t                    d_seed = 1;
+    uint32_t                    d_minOperands = 1;
+    uint32_t                    d_maxOperands = 16;
+    uint32_t                    d_maxDepth = 8;         // Parenthesis nesting
+    uint32_t                    d_parenthesisPercent = 15;
+    uint32_t                    d_unaryPercent = 10;
+    uint32_t                    d_literalDigits = 3;
+    uint32_t                    d_variableCount = 3;
+    std::vector<std::string>    d_binaryOperators = { "+", "-", "*", "/", "<", "<=", ">", ">=", "==", "!=" };
+    std::vector<std::string>    d_unaryOperators = { "-", "+", "!" };
+    bool                        d_binaryFormat = false;
+    size_t                      d_threadCount = 1;
+};
+
+struct SplitMix64 {
+    uint64_t d_state;
+
+    uint64_t next() {
+        uint64_t z = (d_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    uint32_t below(uint32_t bound) { return static_cast<uint32_t>((next() >> 32) * bound >> 32); }
+    bool percent(uint32_t chance) { return below(100) < chance; }
+};
+
+enum class CorpusTokenKind : uint8_t {
+    Number,
+    Variable,
+    Operator,
+    LeftParenthesis,
+    RightParenthesis
+};
+
+constexpr char TOKEN_CORPUS_MAGIC[8] = { 'S', 'Y', 'T', 'O', 'K', 'S', '0', '1' };
+
+class TextExpressionSink {
+public:
+    TextExpressionSink(std::string& output) : d_output(output) {}
+
+    void number(int64_t value) {
+        char digits[24];
+        d_output.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+    }
+
+    void variable(uint32_t index) {
+        d_output += 'x';
+        number(index);
+    }
+
+    void binaryOperator(const std::string& symbol) {
+        d_output += ' ';
+        d_output += symbol;
+        d_output += ' ';
+    }
+
+    void unaryOperator(const std::string& symbol) { d_output += symbol; }
+    void leftParenthesis() { d_output += '('; }
+    void rightParenthesis() { d_output += ')'; }
+    void begin() {}
+    void end() { d_output += '\n'; }
+
+private:
+    std::string& d_output;
+};
+
+class BinaryExpressionSink {
+public:
+    BinaryExpressionSink(std::string& output) : d_output(output) {}
+
+    void number(int64_t value) {
+        kind(CorpusTokenKind::Number);
+        append(static_cast<uint64_t>(value));
+    }
+
+    void variable(uint32_t index) {
+        kind(CorpusTokenKind::Variable);
+        append(index);
+    }
+
+    void binaryOperator(const std::string& symbol) { unaryOperator(symbol); }
+
+    void unaryOperator(const std::string& symbol) {
+        kind(CorpusTokenKind::Operator);
+        d_output += static_cast<char>(lookupOperator(symbol) - OPERATOR_TABLE);
+    }
+
+    void leftParenthesis() { kind(CorpusTokenKind::LeftParenthesis); }
+    void rightParenthesis() { kind(CorpusTokenKind::RightParenthesis); }
+
+    // The token count is patched in once the expression is complete
+    void begin() {
+        d_countOffset = d_output.size();
+        d_tokenCount = 0;
+        append(d_tokenCount);
+    }
+
+    void end() {
+        uint32_t count = fromLittleEndian(d_tokenCount);
+        d_output.replace(d_countOffset, sizeof(count), reinterpret_cast<const char*>(&count), sizeof(count));
+    }
+
+private:
+    void kind(CorpusTokenKind tokenKind) {
+        d_output += static_cast<char>(tokenKind);
+        ++d_tokenCount;
+    }
+
+    template <typename T>
+    void append(T value) {
+        value = fromLittleEndian(value);
+        d_output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    std::string&    d_output;
+    size_t          d_countOffset = 0;
+    uint32_t        d_tokenCount = 0;
+};
+
+template <typename Sink>
+void generateExpression(const CorpusOptions& options, uint64_t index, Sink& sink) {
+    SplitMix64 rng = { options.d_seed * 0xD1B54A32D192ED03ull + index };
+    rng.next();
+
+    uint32_t operands = options.d_minOperands + rng.below(options.d_maxOperands - options.d_minOperands + 1);
+    uint32_t depth = 0;
+
+    sink.begin();
+
+    for (uint32_t operand = 0; operand < operands; ++operand) {
+        if (operand > 0)
+            sink.binaryOperator(options.d_binaryOperators[rng.below(static_cast<uint32_t>(options.d_binaryOperators.size()))]);
+
+        // Any number of prefix operators and opening parentheses before the operand
+        while (true) {
+            if (!options.d_unaryOperators.empty() && rng.percent(options.d_unaryPercent))
+                sink.unaryOperator(options.d_unaryOperators[rng.below(static_cast<uint32_t>(options.d_unaryOperators.size()))]);
+
+            if (depth >= options.d_maxDepth || !rng.percent(options.d_parenthesisPercent))
+                break;
+
+            sink.leftParenthesis();
+            ++depth;
+        }
+
+        if (options.d_variableCount > 0 && rng.below(4) == 0) {
+            sink.variable(rng.below(options.d_variableCount));
+        } else {
+            int64_t value = rng.below(10);
+            uint32_t digits = 1 + rng.below(options.d_literalDigits);
+            for (uint32_t digit = 1; digit < digits; ++digit)
+                value = value * 10 + rng.below(10);
+
+            sink.number(value);
+        }
+
+        while (depth > 0 && rng.percent(options.d_parenthesisPercent)) {
+            sink.rightParenthesis();
+            --depth;
+        }
+    }
+
+    for (; depth > 0; --depth)
+        sink.rightParenthesis();
+
+    sink.end();
+}
+
+// Returns the text form of the expression at 'index' of the corpus, without the trailing newline
+std::string generateExpression(const CorpusOptions& options, uint64_t index) {
+    std::string text;
+    TextExpressionSink sink(text);
+    generateExpression(options, index, sink);
+    text.pop_back();
+
+    return text;
+}
+
+constexpr size_t CORPUS_CHUNK_EXPRESSIONS = 16 * 1024;
+
+// Generates 'expressionCount' expressions into 'path', returns false on I/O failure
+bool generateCorpus(const CorpusOptions& options, uint64_t expressionCount, const std::string& path) {
+    std::ofstream output(path, std::ios::binary);
+    if (options.d_binaryFormat)
+        output.write(TOKEN_CORPUS_MAGIC, sizeof(TOKEN_CORPUS_MAGIC));
+
+    size_t threadCount = std::max<size_t>(1, options.d_threadCount);
+    std::vector<std::string> buffers(threadCount);
+
+    // Each round every thread fills one chunk, then the chunks are written in order
+    for (uint64_t first = 0; first < expressionCount && output; first += threadCount * CORPUS_CHUNK_EXPRESSIONS) {
+        auto generateChunk = [&](size_t t) {
+            uint64_t begin = std::min(expressionCount, first + t * CORPUS_CHUNK_EXPRESSIONS);
+            uint64_t end = std::min(expressionCount, begin + CORPUS_CHUNK_EXPRESSIONS);
+
+            buffers[t].clear();
+            if (options.d_binaryFormat) {
+                BinaryExpressionSink sink(buffers[t]);
+                for (uint64_t index = begin; index < end; ++index)
+                    generateExpression(options, index, sink);
+            } else {
+                TextExpressionSink sink(buffers[t]);
+                for (uint64_t index = begin; index < end; ++index)
+                    generateExpression(options, index, sink);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threadCount; ++t)
+            workers.emplace_back(generateChunk, t);
+        generateChunk(0);
+
+        for (auto& worker : workers)
+            worker.join();
+
+        for (auto& buffer : buffers)
+            output.write(buffer.data(), buffer.size());
+    }
+
+    return static_cast<bool>(output);
+}
+
+// Reads expressions back from a token corpus written in the binary format
+class TokenCorpusReader {
+public:
+    TokenCorpusReader(const std::string& path) : d_file(path, std::ios::binary) {
+        char magic[8] = {};
+        d_file.read(magic, sizeof(magic));
+        if (!d_file || std::memcmp(magic, TOKEN_CORPUS_MAGIC, sizeof(magic)) != 0) {
+            std::cout << "Invalid token corpus: " << path << "\n";
+            d_file.setstate(std::ios::failbit);
+            d_failed = true;
+        }
+    }
+
+    // Replaces 'tokens' with the next expression, returns false at the end of the corpus or
+    // on a truncated or invalid entry, which failed() tells apart
+    bool readExpression(std::vector<TokenRef>& tokens) {
+        tokens.clear();
+
+        uint32_t count = 0;
+        if (!read(count)) {
+            d_failed = d_failed || d_file.gcount() != 0;
+            return false;
+        }
+
+        d_failed = true;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            uint8_t kind = 0;
+            if (!read(kind))
+                return false;
+
+            switch (static_cast<CorpusTokenKind>(kind)) {
+            case CorpusTokenKind::Number: {
+                uint64_t value = 0;
+                if (!read(value))
+                    return false;
+                tokens.push_back(makeToken<NumberToken>(std::to_string(static_cast<int64_t>(value))));
+                break;
+            }
+            case CorpusTokenKind::Variable: {
+                uint32_t index = 0;
+                if (!read(index))
+                    return false;
+
+                tokens.push_back(makeVariableToken("x" + std::to_string(index)));
+                break;
+            }
+            case CorpusTokenKind::Operator: {
+                uint8_t index = 0;
+                if (!read(index) || index >= std::size(OPERATOR_TABLE))
+                    return false;
+                tokens.push_back(makeOperatorToken(OPERATOR_TABLE[index].d_symbol));
+                break;
+            }
+            case CorpusTokenKind::LeftParenthesis:
+                tokens.push_back(makeToken<SymbolToken>("("));
+                break;
+            case CorpusTokenKind::RightParenthesis:
+                tokens.push_back(makeToken<SymbolToken>(")"));
+                break;
+            default:
+                std::cout << "Invalid token corpus entry!\n";
+                return false;
+            }
+        }
+
+        d_failed = false;
+        return true;
+    }
+
+    bool failed() const { return d_failed; }
+
+private:
+    template <typename T>
+    bool read(T& value) {
+        d_file.read(reinterpret_cast<char*>(&value), sizeof(value));
+        value = fromLittleEndian(value);
+        return static_cast<bool>(d_file);
+    }
+
+    std::ifstream   d_file;
+    bool            d_failed = false;
+};
+
+// Parses 'key=value' arguments into corpus options, returns false on an unknown key
+bool parseCorpusOptions(int argc, char** argv, CorpusOptions& options) {
+    auto split = [](const std::string& list) {
+        std::vector<std::string> items;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = std::min(list.find(',', start), list.size());
+            if (end > start)
+                items.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return items;
+    };
+
+    for (int i = 0; i < argc; ++i) {
+        std::string argument = argv[i];
+        size_t equals = argument.find('=');
+        std::string key = argument.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : argument.substr(equals + 1);
+        uint32_t number = static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+
+        if (key == "seed")
+            options.d_seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "min-operands")
+            options.d_minOperands = std::max<uint32_t>(1, number);
+        else if (key == "max-operands")
+            options.d_maxOperands = std::max<uint32_t>(1, number);
+        else if (key == "depth")
+            options.d_maxDepth = number;
+        else if (key == "parenthesis-percent")
+            options.d_parenthesisPercent = number;
+        else if (key == "unary-percent")
+            options.d_unaryPercent = number;
+        else if (key == "digits")
+            options.d_literalDigits = std::min<uint32_t>(18, std::max<uint32_t>(1, number));
+        else if (key == "variables")
+            options.d_variableCount = number;
+        else if (key == "operators")
+            options.d_binaryOperators = split(value);
+        else if (key == "unary")
+            options.d_unaryOperators = split(value);
+        else if (key == "format")
+            options.d_binaryFormat = (value == "binary");
+        else if (key == "threads")
+            options.d_threadCount = number;
+        else {
+            std::cout << "Unknown corpus option: " << key << "\n";
+            return false;
+        }
+    }
+
+    options.d_maxOperands = std::max(options.d_minOperands, options.d_maxOperands);
+
+    for (auto& symbol : options.d_binaryOperators) {
+        auto info = lookupOperator(symbol);
+        if (!info || info->d_unary) {
+            std::cout << "Not a binary operator: " << symbol << "\n";
+            return false;
+        }
+    }
+
+    for (auto& symbol : options.d_unaryOperators) {
+        if (symbol != "+" && symbol != "-" && (!lookupOperator(symbol) || !lookupOperator(symbol)->d_unary)) {
+            std::cout << "Not a unary operator: " << symbol << "\n";
+            return false;
+        }
+    }
+
+    if (options.d_binaryOperators.empty()) {
+        std::cout << "At least one binary operator is required!\n";
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Parser comparison
+
+    Runs both parser backends over random well-formed expressions, reports any
+    difference in their output stacks and how long each backend took.
+*/
+
+std::string describeOutputStack(std::stack<TokenRef> expressionStack) {
+    std::string description;
+    while (!expressionStack.empty()) {
+        description += expressionStack.top()->toString();
+        expressionStack.pop();
+    }
+
+    return description;
+}
+
+int compareParserBackends(size_t expressionCount, uint64_t seed) {
+    CorpusOptions options;
+    options.d_seed = seed;
+    options.d_maxDepth = 12;
+
+    std::chrono::nanoseconds elapsed[2] = {};
+    size_t mismatches = 0;
+
+    for (size_t i = 0; i < expressionCount; ++i) {
+        auto expression = generateExpression(options, i);
+        std::string outputs[2];
+
+        for (int backend = 0; backend < 2; ++backend) {
+            auto tokens = tokenizeExpression(expression);
+            auto start = std::chrono::steady_clock::now();
+            auto outputStack = parseTokens(tokens, static_cast<ParserBackend>(backend));
+            elapsed[backend] += std::chrono::steady_clock::now() - start;
+
+            outputs[backend] = describeOutputStack(outputStack);
+        }
+
+        if (outputs[0] != outputs[1]) {
+            if (mismatches++ < 10)
+                std::cout << "Parser mismatch for: " << expression << "\n";
+        }
+    }
+
+    std::cout << "Shunting yard:       " << std::chrono::duration<double, std::milli>(elapsed[0]).count() << " ms\n";
+    std::cout << "Precedence climbing: " << std::chrono::duration<double, std::milli>(elapsed[1]).count() << " ms\n";
+    std::cout << mismatches << " mismatches in " << expressionCount << " expressions\n";
+
+    return mismatches == 0 ? 0 : 1;
+}
+
+/*
+    Hardware performance counters
+
+    Thin wrapper around Linux perf_event_open counting user-space events of the
+    calling thread. Where counters can't be opened (other platforms, containers,
+    perf_event_paranoid) available() is false and only wall time is reported.
+
+    The counters are opened as one group so the kernel schedules them together
+    and ratios such as IPC compare counts over the same intervals. An event the
+    PMU can't fit into the group gets a group of its own. Counts are scaled by
+    time enabled over time running, which corrects for multiplexing when more
+    events are open than the PMU has counters.
+*/
+
+class PerfCounters {
+public:
+    enum Counter {
+        Cycles,
+        Instructions,
+        BranchMisses,
+        L1DataMisses,
+        LastLevelCacheMisses,
+        CounterCount
+    };
+
+    PerfCounters() {
+#ifdef __linux__
+        static const uint32_t types[CounterCount] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+        };
+        static const uint64_t configs[CounterCount] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_MISSES
+        };
+
+        // The first counter that opens leads the group, a PMU lacking one event still reports the others
+        int leader = -1;
+        for (int counter = 0; counter < CounterCount; ++counter) {
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = types[counter];
+            attr.config = configs[counter];
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.disabled = leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            d_descriptors[counter] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (d_descriptors[counter] < 0 && leader >= 0) {
+                attr.disabled = 1;
+                d_descriptors[counter] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                d_leaders[counter] = d_descriptors[counter] >= 0;
+            } else if (leader < 0 && d_descriptors[counter] >= 0) {
+                leader = d_descriptors[counter];
+                d_leaders[counter] = true;
+            }
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (auto descriptor : d_descriptors) {
+            if (descriptor >= 0)
+                close(descriptor);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Whether the counter was opened and, after stop(), whether it ran at all
+    bool available(Counter counter) const { return d_descriptors[counter] >= 0 && !d_notCounted[counter]; }
+
+    bool available() const {
+        return std::any_of(std::begin(d_descriptors), std::end(d_descriptors), [](int descriptor) { return descriptor >= 0; });
+    }
+
+    void start() {
+#ifdef __linux__
+        for (int counter = 0; counter < CounterCount; ++counter) {
+            if (d_leaders[counter]) {
+                ioctl(d_descriptors[counter], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(d_descriptors[counter], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+        }
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        for (int counter = 0; counter < CounterCount; ++counter) {
+            if (d_leaders[counter])
+                ioctl(d_descriptors[counter], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+
+        // Value, time enabled, time running
+        for (int counter = 0; counter < CounterCount; ++counter) {
+            uint64_t data[3] = {};
+            if (d_descriptors[counter] < 0 || read(d_descriptors[counter], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)))
+                continue;
+
+            d_notCounted[counter] = data[2] == 0;
+            d_values[counter] = data[2] == 0 || data[1] == data[2]
+                ? data[0] : static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+        }
+#endif
+    }
+
+    uint64_t value(Counter counter) const { return d_values[counter]; }
+
+    // Prints every available counter divided by 'units', e.g. per token
+    void print(double units, const char* unit) const {
+        static const char* names[CounterCount] = { "cycles", "instructions", "branch misses", "L1D misses", "LLC misses" };
+
+        for (int counter = 0; counter < CounterCount; ++counter) {
+            if (available(static_cast<Counter>(counter)))
+                std::cout << ", " << d_values[counter] / units << " " << names[counter] << "/" << unit;
+        }
+
+        if (available(Cycles) && available(Instructions) && d_values[Cycles] > 0)
+            std::cout << ", IPC " << static_cast<double>(d_values[Instructions]) / d_values[Cycles];
+    }
+
+private:
+    int         d_descriptors[CounterCount] = { -1, -1, -1, -1, -1 };
+    bool        d_leaders[CounterCount] = {};       // Enabled and disabled together with their group
+    bool        d_notCounted[CounterCount] = {};    // Never scheduled onto the PMU during the last run
+    uint64_t    d_values[CounterCount] = {};
+};
+
+/*
+    Interpreter benchmark
+
+    Evaluates a set of random compiled expressions with and without top-of-stack
+    caching and reports time, instructions and IPC for each variant.
+*/
+
+int benchmarkInterpreter(size_t expressionCount, size_t iterations) {
+    CorpusOptions options;
+    options.d_minOperands = 4;
+    options.d_maxOperands = 32;
+
+    std::vector<CompiledExpression> programs;
+    size_t instructionCount = 0;
+
+    for (uint64_t index = 0; programs.size() < expressionCount; ++index) {
+        auto tokens = tokenizeExpression(generateExpression(options, index));
+        auto program = compileExpression(shuntingYardAlgorithm(tokens));
+        if (program.valid() && program.d_maxStackDepth <= INLINE_STACK_DEPTH) {
+            instructionCount += program.d_code.size();
+            programs.push_back(std::move(program));
+        }
+    }
+
+    const int64_t variables[] = { 3, -7, 11 }; // Programs number their slots in order of first use
+    PerfCounters counters;
+    if (!counters.available())
+        std::cout << "Hardware counters unavailable, reporting wall time only\n";
+
+    auto run = [&](const char* name, int64_t (*interpreter)(const CompiledExpression&, const int64_t*, int64_t*)) {
+        int64_t stack[INLINE_STACK_DEPTH];
+        int64_t checksum = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        counters.start();
+        for (size_t i = 0; i < iterations; ++i) {
+            for (auto& program : programs)
+                checksum += interpreter(program, variables, stack);
+        }
+        counters.stop();
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double operations = static_cast<double>(instructionCount) * iterations;
+        std::cout << name << ": " << elapsed * 1e9 / operations << " ns/op";
+        counters.print(operations, "op");
+        std::cout << " (checksum " << checksum << ")\n";
+    };
+
+    run("Memory stack    ", [](const CompiledExpression& program, const int64_t* values, int64_t* stack) {
+        return runProgramUncached(program, values, stack);
+    });
+    run("Top-of-stack reg", [](const CompiledExpression& program, const int64_t* values, int64_t* stack) {
+        return runProgram(program, values, stack);
+    });
+
+    return 0;
+}
+
+/*
+    Phase benchmark
+
+    Measures lexing, parsing, the reference token evaluator, compilation and the
+    compiled interpreter separately over the same random expressions, and reports
+    wall time and hardware counters per input token for each phase. A token
+    corpus written by '--generate ... format=binary' is already lexed, so
+    benchmarking one starts at parsing.
+*/
+
+// Times 'body' as one phase over 'tokenCount' tokens
+template <typename Body>
+void measurePhase(const char* phase, double tokenCount, PerfCounters& counters, Body&& body) {
+    auto start = std::chrono::steady_clock::now();
+    counters.start();
+    body();
+    counters.stop();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << phase << ": " << elapsed * 1e3 << " ms, " << elapsed * 1e9 / tokenCount << " ns/token";
+    counters.print(tokenCount, "token");
+    std::cout << "\n";
+}
+
+// Measures every phase after lexing, returns 1 if the evaluators disagree
+int benchmarkLexedPhases(std::vector<std::vector<TokenRef>>& tokenLists, double tokenCount,
+                         const VariableBindings& bindings, ParserBackend backend, PerfCounters& counters) {
+    std::vector<std::stack<TokenRef>> outputStacks(tokenLists.size());
+    std::vector<CompiledExpression> programs(tokenLists.size());
+    std::vector<std::vector<int64_t>> variableValues(tokenLists.size());
+    int64_t checksum = 0;
+
+    measurePhase("Parsing              ", tokenCount, counters, [&]() {
+        for (size_t i = 0; i < tokenLists.size(); ++i)
+            outputStacks[i] = parseTokens(tokenLists[i], backend);
+    });
+
+    // The token evaluator consumes its stack, copy them outside the measurement
+    auto evaluationStacks = outputStacks;
+    measurePhase("Evaluation (tokens)  ", tokenCount, counters, [&]() {
+        for (auto& expressionStack : evaluationStacks)
+            checksum += evaluateExpressionTokens(expressionStack, &bindings);
+    });
+
+    measurePhase("Compilation          ", tokenCount, counters, [&]() {
+        for (size_t i = 0; i < tokenLists.size(); ++i)
+            programs[i] = compileExpression(outputStacks[i]);
+    });
+
+    for (size_t i = 0; i < programs.size(); ++i)
+        variableValues[i] = bindVariables(programs[i], bindings);
+
+    measurePhase("Evaluation (compiled)", tokenCount, counters, [&]() {
+        for (size_t i = 0; i < programs.size(); ++i)
+            checksum -= evaluateCompiledExpression(programs[i], variableValues[i].data());
+    });
+
+    // Both evaluators must agree, so the checksum cancels out
+    std::cout << "Checksum: " << checksum << "\n";
+    return checksum == 0 ? 0 : 1;
+}
+
+int benchmarkPhases(size_t expressionCount, uint32_t maxDepth, ParserBackend backend) {
+    CorpusOptions options;
+    options.d_maxDepth = maxDepth;
+
+    std::vector<std::string> expressions;
+    for (size_t i = 0; i < expressionCount; ++i)
+        expressions.push_back(generateExpression(options, i));
+
+    const VariableBindings bindings = { { "x0", 3 }, { "x1", -7 }, { "x2", 11 } };
+    std::vector<std::vector<TokenRef>> tokenLists(expressions.size());
+    double tokenCount = 0;
+
+    PerfCounters counters;
+    if (!counters.available())
+        std::cout << "Hardware counters unavailable, reporting wall time only\n";
+
+    // Token count is only known after lexing, so the lexing phase is timed on a first pass
+    for (auto& expression : expressions)
+        tokenCount += static_cast<double>(tokenizeExpression(expression).size());
+    std::cout << expressions.size() << " expressions, " << tokenCount << " tokens\n";
+
+    measurePhase("Lexing               ", tokenCount, counters, [&]() {
+        for (size_t i = 0; i < expressions.size(); ++i)
+            tokenLists[i] = tokenizeExpression(expressions[i]);
+    });
+
+    return benchmarkLexedPhases(tokenLists, tokenCount, bindings, backend, counters);
+}
+
+int benchmarkTokenCorpus(const std::string& path, ParserBackend backend) {
+    TokenCorpusReader reader(path);
+    std::vector<std::vector<TokenRef>> tokenLists;
+    VariableBindings bindings;
+    double tokenCount = 0;
+
+    for (std::vector<TokenRef> tokens; reader.readExpression(tokens);) {
+        // The corpus names its variables x<index>, each gets a small value of its own
+        for (auto& token : tokens) {
+            if (token->type() == TokenType::Variable)
+                bindings.emplace(as<VariableToken>(token)->name(), static_cast<int64_t>(bindings.size() % 23) - 11);
+        }
+
+        tokenCount += static_cast<double>(tokens.size());
+        tokenLists.push_back(std::move(tokens));
+    }
+
+    if (reader.failed() || tokenLists.empty()) {
+        std::cout << "Could not read token corpus: " << path << "\n";
+        return 1;
+    }
+
+    PerfCounters counters;
+    if (!counters.available())
+        std::cout << "Hardware counters unavailable, reporting wall time only\n";
+
+    std::cout << tokenLists.size() << " expressions, " << tokenCount << " tokens (pre-tokenized)\n";
+    return benchmarkLexedPhases(tokenLists, tokenCount, bindings, backend, counters);
+}
+
+/*
+    Shape cache benchmark
+
+    Compiles a generated corpus once per expression and once per literal-free
+    shape, and reports compile time, distinct shapes and program memory.
+*/
+
+int benchmarkShapeCache(size_t expressionCount) {
+    // Literal-only expressions, like recomputation corpora that differ only in their numbers
+    CorpusOptions options;
+    options.d_maxOperands = 4;
+    options.d_maxDepth = 2;
+    options.d_unaryPercent = 0;
+    options.d_variableCount = 0;
+
+    std::vector<std::string> expressions;
+    for (size_t i = 0; i < expressionCount; ++i)
+        expressions.push_back(generateExpression(options, i));
+
+    const int64_t variables[] = { 3, -7, 11 };
+    std::vector<CompiledExpression> programs(expressions.size());
+    std::vector<LiftedExpression> lifted(expressions.size());
+    ShapeCache cache;
+    int64_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < expressions.size(); ++i) {
+        auto tokens = tokenizeExpression(expressions[i]);
+        programs[i] = compileExpression(shuntingYardAlgorithm(tokens));
+    }
+    auto compileTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < expressions.size(); ++i)
+        lifted[i] = cache.compile(expressions[i]);
+    auto liftTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t programBytes = 0;
+    size_t literalBytes = 0;
+    for (size_t i = 0; i < expressions.size(); ++i) {
+        programBytes += programs[i].d_code.size() * sizeof(Instruction);
+        literalBytes += lifted[i].d_literals.size() * sizeof(int64_t);
+        checksum += evaluateCompiledExpression(programs[i], variables) - evaluateLiftedExpression(lifted[i], variables);
+    }
+
+    size_t shapeBytes = 0;
+    std::unordered_map<const CompiledExpression*, size_t> shapes;
+    for (auto& expression : lifted) {
+        if (shapes.emplace(expression.d_shape.get(), 0).second)
+            shapeBytes += expression.d_shape->d_code.size() * sizeof(Instruction);
+    }
+
+    std::cout << expressions.size() << " expressions, " << cache.shapeCount() << " distinct shapes\n";
+    std::cout << "Per expression: " << compileTime * 1e3 << " ms, " << programBytes / 1024 << " KB of code\n";
+    std::cout << "Per shape     : " << liftTime * 1e3 << " ms, " << shapeBytes / 1024 << " KB of code + "
+              << literalBytes / 1024 << " KB of literals\n";
+
+    std::vector<int64_t> results(expressions.size());
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < expressions.size(); ++i)
+        results[i] = evaluateLiftedExpression(lifted[i], variables);
+    auto scalarTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<int64_t> groupedResults(expressions.size());
+    std::vector<const int64_t*> expressionVariables(expressions.size(), variables);
+    start = std::chrono::steady_clock::now();
+    ShapeGroups groups(lifted);
+    auto groupingTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    groups.evaluate(expressionVariables, groupedResults.data());
+    auto groupedTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Evaluation    : " << scalarTime * 1e3 << " ms one by one, " << groupedTime * 1e3
+              << " ms shape-grouped (after " << groupingTime * 1e3 << " ms grouping)\n";
+    for (size_t i = 0; i < expressions.size(); ++i)
+        checksum += results[i] - groupedResults[i];
+
+    // Both must evaluate identically, so the checksum cancels out
+    std::cout << "Checksum: " << checksum << "\n";
+    return checksum == 0 ? 0 : 1;
+}
+
+/*
+    NUMA placement benchmark
+
+    Evaluates the same wide expression over node-local and interleaved shards
+    and reports rows per second for each placement.
+*/
+
+#ifdef __linux__
+
+int benchmarkNumaPlacement(size_t rowCount, size_t threadsPerNode, size_t iterations) {
+    const char* expression = "a * 3 + b * b - c / 7 + d * a - b * c + d / 3 > a - d";
+    auto tokens = tokenizeExpression(expression);
+    auto program = compileExpression(shuntingYardAlgorithm(tokens));
+    if (!program.valid())
+        return 1;
+
+    SplitMix64 random{ 1 };
+    std::vector<ColumnVector> columns(program.d_variables.size(), ColumnVector(rowCount));
+    ColumnBatch batch;
+    for (auto& column : columns) {
+        for (auto& value : column)
+            value = static_cast<int64_t>(random.below(2001)) - 1000;
+        batch.d_columns.push_back(column.data());
+    }
+    batch.d_rowCount = rowCount;
+
+    auto nodes = numaTopology();
+    std::cout << nodes.size() << " NUMA node(s), " << threadsPerNode << " thread(s) per node\n";
+
+    auto run = [&](const char* name, NumaPlacement placement) {
+        NumaShardedBatch sharded(batch, placement);
+        sharded.evaluate(program, threadsPerNode);
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+            sharded.evaluate(program, threadsPerNode);
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ColumnVector results(rowCount);
+        sharded.copyResults(results.data());
+        int64_t checksum = 0;
+        for (auto value : results)
+            checksum += value;
+
+        std::cout << name << ": " << rowCount * iterations / elapsed / 1e6 << " Mrows/s (checksum " << checksum << ")\n";
+    };
+
+    run("Interleaved", NumaPlacement::Interleaved);
+    run("Node-local ", NumaPlacement::Local);
+
+    if (hugePageMode() != HugePageMode::Off)
+        printHugePageStats();
+    return 0;
+}
+
+#endif // __linux__
+
+/*
+    Hot reload stress test
+
+    Readers evaluate the current rule set in a loop while a writer keeps
+    replacing it. Every read nests a second read and keeps using the outer set
+    after the inner guard has left, which is exactly what a non-reentrant guard
+    would get wrong. Build with -fsanitize=thread or -fsanitize=address so an
+    early free is reported rather than merely likely to crash.
+*/
+
+// Each rule set is the single rule "<k>", so every evaluation can check it read a whole set
+int stressHotReload(size_t readerCount, size_t reloads) {
+    HotExpressionSet rules;
+    rules.publish(ExpressionSet::compile({ "0" }, 0));
+
+    std::atomic<bool> stopping{ false };
+    std::atomic<size_t> reads{ 0 };
+    std::atomic<size_t> failures{ 0 };
+    std::vector<std::thread> readers;
+
+    for (size_t i = 0; i < readerCount; ++i) {
+        readers.emplace_back([&]() {
+            while (!stopping.load(std::memory_order_relaxed)) {
+                rules.read([&](const ExpressionSet& set) {
+                    uint64_t outerVersion = set.d_version;
+                    uint64_t innerVersion = rules.version();
+                    std::this_thread::yield();
+
+                    // The outer set must still be intact after the nested guard left
+                    int64_t expected = std::atoll(set.d_expressions[0].c_str());
+                    if (evaluateCompiledExpression(set.d_programs[0], nullptr) != expected ||
+                        set.d_version != outerVersion || innerVersion < outerVersion)
+                        failures.fetch_add(1);
+                    return 0;
+                });
+                reads.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    for (size_t k = 1; k <= reloads; ++k) {
+        rules.publish(ExpressionSet::compile({ std::to_string(k) }, 0));
+        if (k % 64 == 0)
+            std::this_thread::yield();
+    }
+
+    stopping.store(true);
+    for (auto& reader : readers)
+        reader.join();
+
+    // Leaving the last guard reclaims without waiting for another retire
+    rules.read([](const ExpressionSet&) { return 0; });
+    size_t retired = EpochDomain::instance().retiredCount();
+
+    std::cout << reads.load() << " reads, " << reloads << " reloads, " << failures.load() << " failures, "
+              << retired << " sets awaiting reclamation\n";
+    return failures.load() == 0 && retired == 0 ? 0 : 1;
+}
+
+/*
+    Asynchronous evaluation stress test
+
+    Coroutines parse expressions too long to parse inline and evaluate a
+    program too long to evaluate inline, all through the worker pool, and
+    compare every result with the synchronous path. Many evaluations of the
+    shared program are in flight at once, so they should arrive in batches.
+*/
+
+#if defined(__cpp_impl_coroutine)
+
+// Eagerly started coroutine that nobody awaits, completion is reported through 'Countdown'
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::abort(); }
+    };
+};
+
+class Countdown {
+public:
+    explicit Countdown(size_t count) : d_count(count) {}
+
+    void arrive() {
+        std::lock_guard<std::mutex> lock(d_mutex);
+        if (--d_count == 0)
+            d_done.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(d_mutex);
+        d_done.wait(lock, [this]() { return d_count == 0; });
+    }
+
+private:
+    std::mutex              d_mutex;
+    std::condition_variable d_done;
+    size_t                  d_count;
+};
+
+DetachedTask parseAndCompare(std::string expression, std::atomic<size_t>& failures, Countdown& done) {
+    CompiledExpression program = co_await parseAsync(expression);
+
+    auto tokens = tokenizeExpression(expression);
+    auto expected = compileExpression(shuntingYardAlgorithm(tokens));
+    std::vector<int64_t> values(program.d_variables.size(), 3);
+    if (!program.valid() || evaluateCompiledExpression(program, values.data()) != evaluateCompiledExpression(expected, values.data()))
+        failures.fetch_add(1);
+
+    done.arrive();
+}
+
+DetachedTask evaluateAndCompare(const CompiledExpression& program, std::vector<int64_t> values,
+                                std::atomic<size_t>& failures, Countdown& done) {
+    int64_t result = co_await evaluateAsync(program, values.data());
+    if (result != evaluateCompiledExpression(program, values.data()))
+        failures.fetch_add(1);
+
+    done.arrive();
+}
+
+int stressAsyncEvaluation(size_t coroutines) {
+    std::atomic<size_t> failures{ 0 };
+
+    // Sums of products long enough to leave both inline thresholds behind
+    auto sumOfProducts = [](size_t terms, size_t seed) {
+        std::string expression = "x";
+        for (size_t i = 0; i < terms; ++i)
+            expression += " + x * " + std::to_string((seed + i) % 97) + " - y";
+        return expression;
+    };
+
+    size_t parses = std::max<size_t>(1, coroutines / 16);
+    Countdown parsed(parses);
+    for (size_t i = 0; i < parses; ++i)
+        parseAndCompare(sumOfProducts(ASYNC_INLINE_PARSE_LENGTH / 8, i), failures, parsed);
+    parsed.wait();
+
+    auto tokens = tokenizeExpression(sumOfProducts(ASYNC_INLINE_INSTRUCTIONS, 0));
+    auto program = compileExpression(shuntingYardAlgorithm(tokens));
+    Countdown evaluated(coroutines);
+    for (size_t i = 0; i < coroutines; ++i)
+        evaluateAndCompare(program, { static_cast<int64_t>(i), static_cast<int64_t>(i % 7) }, failures, evaluated);
+    evaluated.wait();
+
+    auto stats = AsyncEvaluator::instance().stats();
+    std::cout << parses << " parses, " << stats.d_evaluations << " evaluations in " << stats.d_batches
+              << " batches, " << failures.load() << " failures\n";
+    return failures.load() == 0 ? 0 : 1;
+}
+
+#endif
+
+/*
+    Differential fuzzing
+
+    Every evaluation backend must agree with the reference token evaluator on
+    the result, and every parser on whether an expression is accepted at all.
+    findBackendDivergence checks one expression, either from the libFuzzer entry
+    point (build with -DSHUNTING_YARD_FUZZER -fsanitize=fuzzer) or from the
+    '--fuzz' driver, which feeds it generated and randomly mutated expressions.
+
+    The scalar backends (compiled, uncached, precedence climbing, streaming,
+    budgeted, shape cache and decimal at scale 0) are checked on a few rows, the
+    batch, filter, zone map and aggregation backends on batches of several
+    blocks. Shape groups and the shared store need many expressions at once, so
+    the driver checks them once per FUZZ_BATCH_SIZE expressions.
+*/
+
+constexpr size_t FUZZ_MAX_INPUT = 4096;    // Keeps the recursive backends off deep native stacks
+
+// Batches span several blocks of every block size, end in a partial block and are long
+// enough to be aggregated by two threads. The first FUZZ_REFERENCE_ROWS rows are also
+// evaluated by the token evaluator and the scalar backends.
+constexpr size_t FUZZ_ROW_COUNT = 8 * BATCH_BLOCK_SIZE + 37;
+constexpr size_t FUZZ_REFERENCE_ROWS = 8;
+
+// Values bound to a variable for each fuzzed row, half of them ones that overflow when combined
+inline int64_t fuzzVariableValue(const std::string& name, size_t row) {
+    static const int64_t edges[] = { 0, -1, std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min() };
+    if (row % 8 >= 4)
+        return edges[(row / 8 + row + name.size()) % std::size(edges)];
+
+    return static_cast<int64_t>(std::hash<std::string>()(name) % 201) - 100 + static_cast<int64_t>(row % 1024) * 37;
+}
+
+constexpr size_t FUZZ_ZONE_ROW_COUNT = 3 * BATCH_BLOCK_SIZE + 17;
+
+// Filters multi-block columns with and without a zone map. The columns are sorted (blocks
+// the intervals decide), blocks of one edge value (singleton intervals) and random values.
+std::string findZoneMapDivergence(const CompiledExpression& program, const std::string& expression) {
+    static const int64_t edges[] = { 0, -1, 1, std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min() };
+    SplitMix64 rng = { std::hash<std::string>()(expression) };
+    std::vector<ColumnVector> columns(program.d_variables.size(), ColumnVector(FUZZ_ZONE_ROW_COUNT));
+
+    for (int layout = 0; layout < 3; ++layout) {
+        for (size_t slot = 0; slot < columns.size(); ++slot) {
+            for (size_t row = 0; row < FUZZ_ZONE_ROW_COUNT; ++row) {
+                int64_t centered = static_cast<int64_t>(row) - static_cast<int64_t>(FUZZ_ZONE_ROW_COUNT / 2);
+                switch (layout) {
+                case 0:  columns[slot][row] = centered * static_cast<int64_t>(slot + 1) * 3; break;
+                case 1:  columns[slot][row] = edges[(row / BATCH_BLOCK_SIZE + slot) % std::size(edges)]; break;
+                default: columns[slot][row] = rng.below(16) == 0 ? edges[rng.below(std::size(edges))]
+                                                                 : static_cast<int64_t>(rng.below(2001)) - 1000; break;
+                }
+            }
+        }
+
+        ColumnBatch batch;
+        for (auto& column : columns)
+            batch.d_columns.push_back(column.data());
+        batch.d_rowCount = FUZZ_ZONE_ROW_COUNT;
+
+        if (filterBatch(program, batch, ZoneMap::build(batch)) != filterBatch(program, batch))
+            return "Zone map filter differs (layout " + std::to_string(layout) + ")";
+    }
+
+    return {};
+}
+
+// Returns a description of the first disagreement between backends, or an empty string
+std::string findBackendDivergence(const std::string& expression) {
+    // The parsers flag operators as unary in place, so each one gets its own tokens
+    auto shuntingYardTokens = tokenizeExpression(expression);
+    auto climbingTokens = tokenizeExpression(expression);
+
+    auto program = compileExpression(shuntingYardAlgorithm(shuntingYardTokens));
+    auto climbingProgram = compileExpression(precedenceClimbingAlgorithm(climbingTokens));
+
+    VariableBindings bindings;
+    for (auto& name : program.d_variables)
+        bindings[name] = fuzzVariableValue(name, 0);
+
+    std::istringstream input(expression);
+    int64_t streamResult = 0;
+    bool streamAccepted = evaluateExpressionStream(input, streamResult, &bindings);
+
+    // A window of a few bytes makes tokens straddle window boundaries and widen the window
+    ExecutionBudget budget;
+    budget.d_lexWindow = 1 + std::hash<std::string>()(expression) % 8;
+    budget.d_maxLexWindow = FUZZ_MAX_INPUT;
+    CompiledExpression budgetProgram;
+    bool budgetAccepted = compileWithBudget(expression, budget, budgetProgram) == BudgetStatus::Ok;
+
+    ShapeCache cache;
+    auto lifted = cache.compile(expression);
+
+    if (program.valid() != climbingProgram.valid() || program.valid() != streamAccepted ||
+        program.valid() != budgetAccepted || program.valid() != lifted.valid())
+        return std::string("Acceptance differs: shunting yard ") + (program.valid() ? "accepts" : "rejects") +
+               ", precedence climbing " + (climbingProgram.valid() ? "accepts" : "rejects") +
+               ", streaming " + (streamAccepted ? "accepts" : "rejects") +
+               ", budgeted " + (budgetAccepted ? "accepts" : "rejects") +
+               ", shape cache " + (lifted.valid() ? "accepts" : "rejects");
+
+    if (!program.valid())
+        return {};
+
+    // At scale 0 with truncation, decimal * and / are the integer ones. Expressions with
+    // operators decimal mode lacks, or literals beyond its range, are not compared.
+    auto decimalTokens = tokenizeExpression(expression);
+    auto decimal = compileDecimalExpression<int64_t>(shuntingYardAlgorithm(decimalTokens), { 0, DecimalRounding::Truncate });
+
+    std::vector<std::vector<int64_t>> columns(program.d_variables.size(), std::vector<int64_t>(FUZZ_ROW_COUNT));
+    for (size_t slot = 0; slot < program.d_variables.size(); ++slot) {
+        for (size_t row = 0; row < FUZZ_ROW_COUNT; ++row)
+            columns[slot][row] = fuzzVariableValue(program.d_variables[slot], row);
+    }
+
+    // Reference results from the token evaluator
+    std::vector<int64_t> expected(FUZZ_ROW_COUNT);
+
+    for (size_t row = 0; row < FUZZ_REFERENCE_ROWS; ++row) {
+        for (size_t slot = 0; slot < program.d_variables.size(); ++slot)
+            bindings[program.d_variables[slot]] = columns[slot][row];
+
+        auto tokens = tokenizeExpression(expression);
+        auto expressionStack = shuntingYardAlgorithm(tokens);
+        bool referenceFailed = false;
+        expected[row] = evaluateExpressionTokens(expressionStack, &bindings, &referenceFailed);
+        if (referenceFailed)
+            return "Token evaluator rejects an expression the compiler accepts";
+
+        auto values = bindVariables(program, bindings);
+        auto climbingValues = bindVariables(climbingProgram, bindings);
+        auto budgetValues = bindVariables(budgetProgram, bindings);
+        int64_t stack[INLINE_STACK_DEPTH];
+        int64_t budgetResult = 0;
+
+        std::vector<int64_t> liftedValues, decimalValues;
+        for (auto& name : lifted.d_shape->d_variables)
+            liftedValues.push_back(bindings[name]);
+        for (auto& name : decimal.d_program.d_variables)
+            decimalValues.push_back(bindings[name]);
+
+        auto check = [&](const char* backend, int64_t actual) {
+            return actual == expected[row] ? std::string()
+                : std::string(backend) + " returned " + std::to_string(actual) + ", expected " +
+                  std::to_string(expected[row]) + " (row " + std::to_string(row) + ")";
+        };
+
+        std::string divergence;
+        if (divergence.empty())
+            divergence = check("Compiled interpreter", evaluateCompiledExpression(program, values.data()));
+        if (divergence.empty())
+            divergence = check("Precedence climbing", evaluateCompiledExpression(climbingProgram, climbingValues.data()));
+        if (divergence.empty() && program.d_maxStackDepth <= INLINE_STACK_DEPTH)
+            divergence = check("Uncached interpreter", runProgramUncached(program, values.data(), stack));
+        if (divergence.empty() && row == 0)
+            divergence = check("Streaming", streamResult);
+        if (divergence.empty() && evaluateWithBudget(budgetProgram, budgetValues.data(), budget, budgetResult) != BudgetStatus::Ok)
+            divergence = "Budgeted evaluation failed without a limit";
+        if (divergence.empty())
+            divergence = check("Budgeted", budgetResult);
+        if (divergence.empty())
+            divergence = check("Shape cache", evaluateLiftedExpression(lifted, liftedValues.data()));
+        if (divergence.empty() && decimal.valid())
+            divergence = check("Decimal", evaluateDecimal(decimal, decimalValues.data()));
+        if (!divergence.empty())
+            return divergence;
+    }
+
+    // The compiled interpreter, checked above, is the reference for the remaining rows
+    std::vector<int64_t> values(program.d_variables.size());
+    for (size_t row = FUZZ_REFERENCE_ROWS; row < FUZZ_ROW_COUNT; ++row) {
+        for (size_t slot = 0; slot < program.d_variables.size(); ++slot)
+            values[slot] = columns[slot][row];
+        expected[row] = evaluateCompiledExpression(program, values.data());
+    }
+
+    ColumnBatch batch;
+    for (auto& column : columns)
+        batch.d_columns.push_back(column.data());
+    batch.d_rowCount = FUZZ_ROW_COUNT;
+
+    auto firstDifference = [&](const char* backend, const std::vector<int64_t>& results) {
+        auto mismatch = std::mismatch(results.begin(), results.end(), expected.begin());
+        return mismatch.first == results.end() ? std::string()
+            : std::string(backend) + " differs (row " + std::to_string(mismatch.first - results.begin()) + ")";
+    };
+
+    std::vector<int64_t> results(FUZZ_ROW_COUNT);
+    evaluateBatch(program, batch, results.data());
+    auto divergence = firstDifference("Batch evaluation", results);
+    if (divergence.empty() && decimal.valid()) {
+        evaluateDecimalBatch(decimal, batch, results.data());
+        divergence = firstDifference("Decimal batch evaluation", results);
+    }
+    if (!divergence.empty())
+        return divergence;
+
+    SelectionVector expectedSelection;
+    for (size_t row = 0; row < FUZZ_ROW_COUNT; ++row) {
+        if (expected[row] != 0)
+            expectedSelection.push_back(static_cast<uint32_t>(row));
+    }
+
+    if (filterBatch(program, batch) != expectedSelection ||
+        selectionFromBitmask(filterBatchBitmask(program, batch)) != expectedSelection)
+        return "Batch filter differs";
+
+    if (filterBatch(program, batch, ZoneMap::build(batch)) != expectedSelection)
+        return "Zone map filter differs";
+
+    SelectionVector everyOtherRow;
+    std::vector<int64_t> expectedSelected;
+    for (size_t row = 0; row < FUZZ_ROW_COUNT; row += 2) {
+        everyOtherRow.push_back(static_cast<uint32_t>(row));
+        expectedSelected.push_back(expected[row]);
+    }
+
+    std::vector<int64_t> selectedResults(everyOtherRow.size());
+    evaluateBatch(program, batch, everyOtherRow, selectedResults.data());
+    if (selectedResults != expectedSelected)
+        return "Selected batch evaluation differs";
+
+    auto sameAggregate = [](const Aggregate& lhs, const Aggregate& rhs) {
+        return lhs.d_sum == rhs.d_sum && lhs.d_min == rhs.d_min && lhs.d_max == rhs.d_max && lhs.d_count == rhs.d_count;
+    };
+
+    Aggregate expectedAggregate, expectedSelectedAggregate;
+    accumulateBlock(expected.data(), expected.size(), expectedAggregate);
+    accumulateBlock(expectedSelected.data(), expectedSelected.size(), expectedSelectedAggregate);
+
+    if (!sameAggregate(aggregateBatch(program, batch), expectedAggregate) ||
+        !sameAggregate(aggregateBatch(program, batch, 2), expectedAggregate))
+        return "Aggregation differs";
+    if (!sameAggregate(aggregateBatch(program, batch, everyOtherRow), expectedSelectedAggregate))
+        return "Selected aggregation differs";
+
+    return findZoneMapDivergence(program, expression);
+}
+
+// Replaces every digit, which keeps the tokens and so the shape but changes the literals
+std::string redrawLiterals(std::string expression, SplitMix64& rng) {
+    for (auto& c : expression) {
+        if (std::isdigit(static_cast<unsigned char>(c)))
+            c = static_cast<char>('0' + rng.below(10));
+    }
+
+    return expression;
+}
+
+constexpr size_t FUZZ_BATCH_SIZE = 64;
+
+// Evaluates the expressions through ShapeGroups and compares every result with evaluating the
+// lifted expression on its own. With 'withGroups' every fourth expression gets enough copies
+// with redrawn literals to form a group, so grouped and one-by-one expressions are mixed.
+std::string findShapeGroupDivergence(const std::vector<std::string>& expressions, bool withGroups, SplitMix64& rng) {
+    ShapeCache cache;
+    std::vector<std::string> sources;
+    std::vector<LiftedExpression> lifted;
+    std::vector<std::vector<int64_t>> values;
+
+    for (size_t i = 0; i < expressions.size(); ++i) {
+        size_t copies = withGroups && i % 4 == 0 ? SHAPE_GROUP_MIN_SIZE + rng.below(8) : 1;
+        for (size_t copy = 0; copy < copies; ++copy) {
+            auto source = copy == 0 ? expressions[i] : redrawLiterals(expressions[i], rng);
+            auto expression = cache.compile(source);
+
+            // Malformed expressions stay in, ShapeGroups must not group them with shape 0
+            std::vector<int64_t> row;
+            for (size_t slot = 0; expression.valid() && slot < expression.d_shape->d_variables.size(); ++slot)
+                row.push_back(fuzzVariableValue(expression.d_shape->d_variables[slot], lifted.size() % FUZZ_REFERENCE_ROWS));
+
+            sources.push_back(std::move(source));
+            lifted.push_back(std::move(expression));
+            values.push_back(std::move(row));
+        }
+    }
+
+    std::vector<const int64_t*> variables;
+    for (auto& row : values)
+        variables.push_back(row.data());
+
+    // Built from a temporary, so evaluating must not read the caller's expressions
+    std::vector<int64_t> results(lifted.size());
+    ShapeGroups groups(std::vector<LiftedExpression>(lifted.begin(), lifted.end()));
+    groups.evaluate(variables, results.data());
+
+    for (size_t i = 0; i < lifted.size(); ++i) {
+        int64_t expected = lifted[i].valid() ? evaluateLiftedExpression(lifted[i], values[i].data()) : 0;
+        if (results[i] != expected)
+            return "Shape-grouped evaluation returned " + std::to_string(results[i]) + ", expected " +
+                   std::to_string(expected) + " for: " + sources[i];
+    }
+
+    return {};
+}
+
+#ifdef __linux__
+// Publishes the accepted expressions to a fresh shared store, looks them up again through a
+// second, read-only mapping and compares the shared programs' results with the originals
+std::string findSharedStoreDivergence(const std::vector<std::string>& expressions) {
+    std::string name = "/shunting-yard-fuzz-" + std::to_string(getpid());
+    auto writer = SharedProgramStore::create(name, 1 << 20, 4 * FUZZ_BATCH_SIZE);
+    auto reader = writer ? SharedProgramStore::open(name) : nullptr;
+    SharedProgramStore::remove(name);
+    if (!reader)
+        return "Shared program store unavailable";
+
+    std::vector<std::pair<std::string, CompiledExpression>> published;
+    for (auto& expression : expressions) {
+        auto tokens = tokenizeExpression(expression);
+        auto program = compileExpression(shuntingYardAlgorithm(tokens));
+        bool duplicate = std::any_of(published.begin(), published.end(), [&](auto& entry) { return entry.first == expression; });
+        if (program.valid() && !duplicate && writer->publish(expression, program))
+            published.emplace_back(expression, std::move(program));
+    }
+
+    // A lifted shape would lose its literals in the store
+    auto tokens = tokenizeExpression("x + 1");
+    if (writer->publish("x + 1", compileExpression(shuntingYardAlgorithm(tokens), true)))
+        return "Shared store accepted a lifted program";
+
+    if (reader->programCount() != published.size())
+        return "Shared store holds " + std::to_string(reader->programCount()) + " programs, expected " +
+               std::to_string(published.size());
+
+    for (auto& [expression, program] : published) {
+        SharedProgram shared;
+        if (!reader->lookup(expression, shared) || shared.variableNames() != program.d_variables)
+            return "Shared store lost: " + expression;
+
+        for (size_t row = 0; row < FUZZ_REFERENCE_ROWS; ++row) {
+            std::vector<int64_t> values;
+            for (auto& name : program.d_variables)
+                values.push_back(fuzzVariableValue(name, row));
+
+            if (evaluateSharedProgram(shared, values.data()) != evaluateCompiledExpression(program, values.data()))
+                return "Shared program differs for: " + expression;
+        }
+    }
+
+    return {};
+}
+#endif
+
+// Generated expressions are too short to reach these, so they are checked on fixed inputs: the
+// windowed lexer reports positions in the whole input and stops widening at d_maxLexWindow
+std::string findBudgetLimitDivergence() {
+    ExecutionBudget budget;
+    budget.d_lexWindow = 8;
+    CompiledExpression program;
+
+    std::string padding(3 * budget.d_lexWindow, ' ');
+    std::ostringstream message;
+    auto output = std::cout.rdbuf(message.rdbuf());
+    auto status = compileWithBudget("x +" + padding + "# 1", budget, program);
+    std::cout.rdbuf(output);
+
+    std::string position = "at position " + std::to_string(3 + padding.size()) + "\n";
+    if (status != BudgetStatus::Malformed || message.str().find(position) == std::string::npos)
+        return "Budgeted lexer reported '" + message.str() + "', expected an error " + position;
+
+    std::string longName(BUDGET_MAX_LEX_WINDOW / 2, 'a');
+    std::string expression = "x + " + longName + " * 2";
+    if (compileWithBudget(expression, ExecutionBudget(), program) != BudgetStatus::Ok || program.d_variables.size() != 2)
+        return "Budgeted lexer rejects a token that fits the widest window";
+
+    budget.d_maxLexWindow = longName.size();
+    if ((status = compileWithBudget(expression, budget, program)) != BudgetStatus::TokenTooLong)
+        return std::string("Budgeted lexer returned '") + describeBudgetStatus(status) + "' for a token wider than its window";
+
+    return {};
+}
+
+// Mutates a generated expression so the parsers also see malformed input
+std::string mutateExpression(std::string expression, SplitMix64& rng) {
+    static const char alphabet[] = "()+-*/%<>=!^&|~ 0123456789x_";
+
+    uint32_t mutations = rng.below(3);
+    for (uint32_t i = 0; i < mutations && !expression.empty(); ++i) {
+        size_t position = rng.below(static_cast<uint32_t>(expression.size()));
+        char c = alphabet[rng.below(sizeof(alphabet) - 1)];
+
+        switch (rng.below(3)) {
+        case 0: expression[position] = c; break;
+        case 1: expression.insert(expression.begin() + position, c); break;
+        default: expression.erase(position, 1); break;
+        }
+    }
+
+    return expression;
+}
+
+// Generator options for one fuzzed expression, every operator in the table is used
+CorpusOptions fuzzCorpusOptions(uint64_t seed, SplitMix64& rng) {
+    CorpusOptions options;
+    options.d_seed = seed;
+    options.d_maxOperands = 1 + rng.below(24);
+    options.d_maxDepth = rng.below(10);
+    options.d_unaryPercent = rng.below(40);
+    options.d_literalDigits = 1 + rng.below(18);
+    options.d_binaryOperators.clear();
+    options.d_unaryOperators = { "-", "+" };
+    for (auto& info : OPERATOR_TABLE)
+        (info.d_unary ? options.d_unaryOperators : options.d_binaryOperators).push_back(info.d_symbol);
+
+    return options;
+}
+
+int runFuzzDriver(size_t iterations, uint64_t seed) {
+    SplitMix64 rng = { seed };
+    size_t divergences = 0;
+    auto output = std::cout.rdbuf();
+    std::vector<std::string> expressionBatch;
+
+    auto limitDivergence = findBudgetLimitDivergence();
+    if (!limitDivergence.empty() && divergences++ < 10)
+        std::cout << limitDivergence << "\n";
+
+    for (size_t i = 0; i < iterations; ++i) {
+        auto options = fuzzCorpusOptions(seed, rng);
+        auto expression = mutateExpression(generateExpression(options, i), rng);
+
+        // Backends report malformed input on stdout, which is expected here
+        std::cout.rdbuf(nullptr);
+        auto divergence = findBackendDivergence(expression);
+        std::cout.rdbuf(output);
+        std::cout.clear();
+
+        if (!divergence.empty() && divergences++ < 10)
+            std::cout << divergence << " for: " << expression << "\n";
+
+        // Shape grouping and the shared store need many expressions at once
+        expressionBatch.push_back(expression);
+        if (expressionBatch.size() == FUZZ_BATCH_SIZE || i + 1 == iterations) {
+            std::vector<std::string> batchDivergences;
+
+            std::cout.rdbuf(nullptr);
+            for (bool withGroups : { false, true })
+                batchDivergences.push_back(findShapeGroupDivergence(expressionBatch, withGroups, rng));
+#ifdef __linux__
+            batchDivergences.push_back(findSharedStoreDivergence(expressionBatch));
+#endif
+            std::cout.rdbuf(output);
+            std::cout.clear();
+
+            for (auto& batchDivergence : batchDivergences) {
+                if (!batchDivergence.empty() && divergences++ < 10)
+                    std::cout << batchDivergence << "\n";
+            }
+            expressionBatch.clear();
+        }
+    }
+
+    std::cout << divergences << " divergences in " << iterations << " expressions\n";
+    return divergences == 0 ? 0 : 1;
+}
+
+/*
+    Code generation round trip
+
+    The helpers in CODEGEN_PRELUDE copy the interpreter's semantics by hand, so
+    '--fuzz-codegen' guards them against drifting apart. It generates a source
+    for fuzzed expressions and edge cases, compiles it with $CXX (c++ by default)
+    together with a driver holding the interpreter's results for the fuzzed rows,
+    and runs the driver, which checks the scalar and the batch entry points.
+*/
+
+// Shifts, divisions and powers where wrapping and truncation are easy to get wrong
+static const char* const CODEGEN_EDGE_EXPRESSIONS[] = {
+    "x / -1", "x % -1", "x / 0", "x % 0", "x / (0 - 7)", "x % (0 - 7)", "(0 - 7) % x",
+    "x << 64", "x << 65", "x >> 63", "x >> -1",
+    "x ** 0", "x ** 5", "x ** 63", "x ** -1", "2 ** -1", "(0 - 1) ** -3", "-x ** 2",
+    "~x & 255 | x ^ 7", "!x + (x <= 0) - (x != 0)",
+};
+
+int runCodegenRoundTrip(size_t expressionCount, uint64_t seed) {
+    SplitMix64 rng = { seed };
+    std::vector<std::string> expressions(std::begin(CODEGEN_EDGE_EXPRESSIONS), std::end(CODEGEN_EDGE_EXPRESSIONS));
+    std::vector<CompiledExpression> programs;
+
+    auto output = std::cout.rdbuf(nullptr);
+    for (size_t i = 0; expressions.size() < std::size(CODEGEN_EDGE_EXPRESSIONS) + expressionCount; ++i) {
+        auto options = fuzzCorpusOptions(seed, rng);
+        expressions.push_back(mutateExpression(generateExpression(options, i), rng));
+
+        // Only valid expressions can be generated
+        auto tokens = tokenizeExpression(expressions.back());
+        auto program = compileExpression(shuntingYardAlgorithm(tokens));
+        if (!program.valid())
+            expressions.pop_back();
+    }
+    for (auto& expression : expressions) {
+        auto tokens = tokenizeExpression(expression);
+        programs.push_back(compileExpression(shuntingYardAlgorithm(tokens)));
+    }
+    std::cout.rdbuf(output);
+
+    std::error_code error;
+    auto directory = std::filesystem::temp_directory_path(error) /
+                     ("shunting-yard-codegen-" + std::to_string(seed) + "-" +
+                      std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    if (error || !std::filesystem::create_directory(directory, error)) {
+        std::cout << "Failed to create a directory for the generated sources\n";
+        return 1;
+    }
+
+    auto sourcePath = directory / "rules.cpp";
+    auto driverPath = directory / "driver.cpp";
+    auto binaryPath = directory / "driver";
+
+    std::ofstream source(sourcePath);
+    bool generated = source && generateExpressionSource(expressions, source, "rules");
+    source.close();
+
+    // One case per expression and row: the variables in slot order and the interpreter's result
+    std::ofstream driver(driverPath);
+    driver << "#include \"rules.cpp\"\n#include <cstdio>\n#include <vector>\n\n";
+    driver << "const int64_t VALUES[] = {\n";
+    for (auto& program : programs) {
+        for (size_t row = 0; row < FUZZ_REFERENCE_ROWS; ++row) {
+            driver << "   ";
+            for (auto& name : program.d_variables)
+                driver << " " << generateInt64Literal(fuzzVariableValue(name, row)) << ",";
+            driver << "\n";
+        }
+    }
+    driver << "    0\n};\n\n";
+
+    driver << "const int64_t EXPECTED[] = {\n";
+    for (auto& program : programs) {
+        driver << "   ";
+        for (size_t row = 0; row < FUZZ_REFERENCE_ROWS; ++row) {
+            std::vector<int64_t> values;
+            for (auto& name : program.d_variables)
+                values.push_back(fuzzVariableValue(name, row));
+            driver << " " << generateInt64Literal(evaluateCompiledExpression(program, values.data())) << ",";
+        }
+        driver << "\n";
+    }
+    driver << "};\n\n";
+
+    driver << "const size_t ROW_COUNT = " << FUZZ_REFERENCE_ROWS << ";\n\n";
+    driver << R"(int main() {
+    size_t failures = 0;
+    const int64_t* values = VALUES;
+
+    for (size_t id = 0; id < rules::EXPRESSION_COUNT; ++id) {
+        const size_t variableCount = rules::EXPRESSIONS[id].variableCount;
+        std::vector<std::vector<int64_t>> columns(variableCount, std::vector<int64_t>(ROW_COUNT));
+        std::vector<const int64_t*> columnPointers;
+        std::vector<int64_t> results(ROW_COUNT);
+
+        for (size_t row = 0; row < ROW_COUNT; ++row, values += variableCount) {
+            for (size_t slot = 0; slot < variableCount; ++slot)
+                columns[slot][row] = values[slot];
+
+            const int64_t expected = EXPECTED[id * ROW_COUNT + row];
+            const int64_t actual = rules::evaluate(id, values);
+            if (actual != expected && failures++ < 10)
+                std::printf("Generated code returned %lld, expected %lld (row %zu) for: %s\n",
+                            static_cast<long long>(actual), static_cast<long long>(expected), row, rules::EXPRESSIONS[id].text);
+        }
+
+        for (auto& column : columns)
+            columnPointers.push_back(column.data());
+        rules::evaluateBatch(id, columnPointers.data(), ROW_COUNT, results.data());
+        for (size_t row = 0; row < ROW_COUNT; ++row) {
+            if (results[row] != EXPECTED[id * ROW_COUNT + row] && failures++ < 10)
+                std::printf("Generated batch code differs (row %zu) for: %s\n", row, rules::EXPRESSIONS[id].text);
+        }
+    }
+
+    std::printf("%zu divergences in %zu generated expressions\n", failures, rules::EXPRESSION_COUNT);
+    return failures == 0 ? 0 : 1;
+}
+)";
+    driver.close();
+
+    const char* compiler = std::getenv("CXX");
+    std::string command = std::string(compiler && *compiler ? compiler : "c++") + " -std=c++17 -O2 -o \"" +
+                          binaryPath.string() + "\" \"" + driverPath.string() + "\"";
+
+    int status = 1;
+    if (!generated || !driver)
+        std::cout << "Failed to write the generated sources to " << directory.string() << "\n";
+    else if (std::system(command.c_str()) != 0)
+        std::cout << "Failed to compile the generated sources: " << command << "\n";
+    else
+        status = std::system(("\"" + binaryPath.string() + "\"").c_str()) == 0 ? 0 : 1;
+
+    std::filesystem::remove_all(directory, error);
+    return status;
+}
+
+#ifdef SHUNTING_YARD_FUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static auto output = std::cout.rdbuf(nullptr);
+    (void)output;
+
+    if (size > FUZZ_MAX_INPUT)
+        return 0;
+
+    auto expression = std::string(reinterpret_cast<const char*>(data), size);
+    auto divergence = findBackendDivergence(expression);
+    if (!divergence.empty()) {
+        std::cerr << divergence << " for: " << expression << "\n";
+        std::abort();
+    }
+
+    return 0;
+}
+#else
+int main(int argc, char** argv) {
+    // '--parser precedence-climbing' selects the parser backend for the other modes
+    ParserBackend backend = ParserBackend::ShuntingYard;
+    if (argc > 2 && std::string(argv[1]) == "--parser") {
+        if (std::string(argv[2]) == "precedence-climbing")
+            backend = ParserBackend::PrecedenceClimbing;
+        else if (std::string(argv[2]) != "shunting-yard") {
+            std::cout << "Unknown parser backend: " << argv[2] << "\n";
+            return 1;
+        }
+
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    // '--huge-pages transparent|explicit' backs large column and result buffers with huge pages
+    if (argc > 2 && std::string(argv[1]) == "--huge-pages") {
+        if (std::string(argv[2]) == "transparent")
+            hugePageMode() = HugePageMode::Transparent;
+        else if (std::string(argv[2]) == "explicit")
+            hugePageMode() = HugePageMode::Explicit;
+        else if (std::string(argv[2]) != "off") {
+            std::cout << "Unknown huge page mode: " << argv[2] << "\n";
+            return 1;
+        }
+
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    if (argc > 2 && std::string(argv[1]) == "--compare-parsers")
+        return compareParserBackends(std::strtoul(argv[2], nullptr, 10), argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1);
+
+    if (argc > 2 && std::string(argv[1]) == "--generate") {
+        // --generate <count> <output> [key=value...]
+        CorpusOptions options;
+        options.d_threadCount = std::thread::hardware_concurrency();
+        if (argc < 4 || !parseCorpusOptions(argc - 4, argv + 4, options))
+            return 1;
+
+        return generateCorpus(options, std::strtoull(argv[2], nullptr, 10), argv[3]) ? 0 : 1;
+    }
+
+    if (argc > 2 && std::string(argv[1]) == "--fuzz")
+        return runFuzzDriver(std::strtoul(argv[2], nullptr, 10), argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1);
+
+    if (argc > 2 && std::string(argv[1]) == "--fuzz-codegen")
+        return runCodegenRoundTrip(std::strtoul(argv[2], nullptr, 10), argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1);
+
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+        return benchmarkPhases(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000, argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 10, backend);
+
+    if (argc > 2 && std::string(argv[1]) == "--bench-corpus")
+        return benchmarkTokenCorpus(argv[2], backend);
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-shapes")
+        return benchmarkShapeCache(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000);
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-interpreter")
+        return benchmarkInterpreter(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000, argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100);
+
+#ifdef __linux__
+    if (argc > 1 && std::string(argv[1]) == "--bench-numa") {
+        size_t threadsPerNode = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : numaTopology().front().d_cpus.size();
+        return benchmarkNumaPlacement(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16 << 20, threadsPerNode, 10);
+    }
+#endif
+
+    if (argc > 1 && std::string(argv[1]) == "--stress-reload")
+        return stressHotReload(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4, argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100000);
+
+#if defined(__cpp_impl_coroutine)
+    if (argc > 1 && std::string(argv[1]) == "--stress-async")
+        return stressAsyncEvaluation(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000);
+#endif
+
+    if (argc > 3 && std::string(argv[1]) == "--codegen")
+        return runCodegenCommand(argv[2], argv[3], argc > 4 ? argv[4] : "expressions");
+
+    if (argc > 3 && std::string(argv[1]) == "--decimal")
+        return runDecimalCommand(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc), backend);
+
+    if (argc == 3 && std::string(argv[1]) == "--stream") {
+        std::ifstream input(argv[2], std::ios::binary);
+        int64_t result = 0;
+        if (!input || !evaluateExpressionStream(input, result))
+            return 1;
+
+        std::cout << "Expression result: " << result << "\n";
+        return 0;
+    }
+
+    if (argc > 1) {
+        if (argc < 4) {
+            std::cout << "Usage: " << argv[0] << " <expression> <input.csv|input.col> <output> [threads]\n";
+            std::cout << "       " << argv[0] << " --stream <expression file>\n";
+            std::cout << "       " << argv[0] << " --decimal <scale>[,rounding][,128] <expression> [name=value...]\n";
+            std::cout << "       " << argv[0] << " --codegen <expression file> <output.cpp> [namespace]\n";
+            std::cout << "       " << argv[0] << " --compare-parsers <count> [seed]\n";
+            std::cout << "       " << argv[0] << " --generate <count> <output> [key=value...]\n";
+            std::cout << "       " << argv[0] << " --fuzz <iterations> [seed]\n";
+            std::cout << "       " << argv[0] << " --fuzz-codegen <expressions> [seed]\n";
+            std::cout << "       " << argv[0] << " --bench [expressions] [max depth]\n";
+            std::cout << "       " << argv[0] << " --bench-corpus <token corpus>\n";
+            std::cout << "       " << argv[0] << " --bench-interpreter [expressions] [iterations]\n";
+            std::cout << "       " << argv[0] << " --bench-shapes [expressions]\n";
+            std::cout << "       " << argv[0] << " --bench-numa [rows] [threads per node]\n";
+            std::cout << "       " << argv[0] << " --stress-reload [readers] [reloads]\n";
+            std::cout << "       " << argv[0] << " --stress-async [coroutines] (C++20 builds)\n";
+            std::cout << "Prefix with '--parser precedence-climbing' to switch parser backends.\n";
+            std::cout << "Prefix with '--huge-pages transparent|explicit' to back large buffers with huge pages.\n";
+            return 1;
+        }
+
+        size_t threadCount = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : std::thread::hardware_concurrency();
+        int status = runBatchCommand(argv[1], argv[2], argv[3], threadCount, backend);
+        if (hugePageMode() != HugePageMode::Off)
+            printHugePageStats();
+        return status;
+    }
+
     for (auto& token : TOKENS) {
         std::cout << token->toString() << "\n";
     }
     std::cout << "\n";
 
-    auto expressionStack = shuntingYardAlgorithm(TOKENS);
+    auto expressionStack = parseTokens(TOKENS, backend);
     printOutputExpressionStack(expressionStack);
 
     auto expressionResult = evaluateExpressionTokens(expressionStack);
@@ -279,3 +6660,4 @@ int main() {
 
     return 0;
 }
+#endif